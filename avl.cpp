@@ -1,732 +1,1801 @@
 #include <iostream>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
 #include <cstdlib>
-#include <stack>
 #include <fstream>
 #include <string>
-#include <sstream>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "avl_tree.h"
+#include "compact_avl_tree.h"
+#include "eytzinger_snapshot.h"
+#include "key_file.h"
+#include "wal.h"
+#include "persistent_avl_tree.h"
+#include "sharded_executor.h"
+#include "command_parser.h"
+#include "command_stream.h"
+#include "output.h"
 
 using namespace std;
 
-// for outputting results
-ofstream outputFile;
-
-// individual node structure: element, left child ptr, right child ptr, isRoot
-struct Node
+// the command tree prints its rebalancing steps to the trace channel
+// and keeps the counters Stats() prints (build with -DAVL_NO_STATS,
+// e.g. make nostats, to compile the counting out)
+struct CommandTreePolicy
 {
-    int data;
-    Node *left;
-    Node *right;
-    bool isRoot;
+    static const bool tracing = true;
+#ifdef AVL_NO_STATS
+    static const bool statistics = false;
+#else
+    static const bool statistics = true;
+#endif
+
+    static void onTrace(const char *event)
+    {
+        trace << event << "\n";
+    }
+
+    template <typename Key>
+    static void onTrace(const char *event, const Key &key)
+    {
+        trace << event << key << "\n";
+    }
 };
 
-// global variable for referencing AVL tree
-Node *AvlTree;
+// nodes keep the sum of their subtree's keys, for Aggregate(sum,a,b)
+// (8 more bytes per node; build with -DAVL_NO_AGGREGATES, e.g.
+// make noaggregates, to drop it & have Aggregate walk the keys instead)
+#ifdef AVL_NO_AGGREGATES
+typedef NoAggregate CommandTreeAggregate;
+#else
+typedef SumAggregate<int> CommandTreeAggregate;
+#endif
+
+// each key carries an int value (Upsert/GetOrInsert/Increment; 0 for
+// keys added any other way). Increments are plain int arithmetic, so
+// keep counters within int range.
+typedef AvlTree<int, int, less<int>, SlabPool, CommandTreePolicy, CommandTreeAggregate> IntTree;
+
+// global AVL tree the commands work on
+IntTree tree;
+
+// compact storage mode (--compact): 12-byte nodes in one vector,
+// used by the commands instead of tree
+CompactAvlTree<int> compactTree;
+bool compactMode = false;
+
+// copy-on-write mode (--mvcc): Insert/Delete publish new versions
+// of mvccTree, and every read pins the current version through
+// mainReader, so background readers (--readers N) never block
+typedef PersistentAvlTree<int> MvccTree;
+MvccTree mvccTree;
+bool mvccMode = false;
+int mainReader = -1;
+
+// sharded mode (--shards N): commands are queued on key-range shards
+// replayed in parallel; results still come out in file order
+ShardedExecutor *shardedTree = NULL;
+
+// read-only copy of the keys made by Freeze(); searches use it
+// until the next Insert/Delete/BulkInsert/Initialize throws it away
+EytzingerSnapshot<int> snapshot;
+bool snapshotValid = false;
+
+// write-ahead log (--wal path): every mutation is logged before it's
+// applied (value changes as the value the key ends up with, range
+// deletes as their bounds); the tree is checkpointed to
+// "<path>.ckpt" every checkpointEvery logged ops (and after BulkInsert
+// & Load, which aren't logged), and the log is emptied. On startup the
+// checkpoint is loaded & the log tail replayed.
+WriteAheadLog wal;
+string walPath;
+size_t checkpointEvery = 1000000;
+// off while the log itself is being replayed
+bool walLogging = false;
+
+// streamed input (stdin, a FIFO, --stream or --follow): read on a
+// background thread while the commands are applied
+CommandStream stream;
+bool streaming = false;
+
+// SIGINT/SIGTERM with --follow: end the input where it is & finish up
+// (flush results, last group commit) instead of dying mid-way
+void stopFollowing(int)
+{
+    stream.stop();
+}
+
+// false if the log has failed; the mutation mustn't be applied then
+bool logMutation(WalOp op, int key)
+{
+    return !walLogging || wal.append(op, key);
+}
+
+bool logValue(int key, int value)
+{
+    return !walLogging || wal.appendSet(key, value);
+}
+
+bool logDeleteRange(int a, int b)
+{
+    return !walLogging || wal.appendDeleteRange(a, b);
+}
+
+// any change to the tree makes the snapshot stale
+void invalidateSnapshot()
+{
+    if (snapshotValid)
+    {
+        snapshot.clear();
+        snapshotValid = false;
+    }
+}
 
 void Initialize()
 {
-    // Initializing AVL Tree to NULL
-    AvlTree = NULL;
+    if (!logMutation(WAL_CLEAR, 0))
+    {
+        return;
+    }
+    // empty the tree, handing every node back to the allocator at once
+    if (shardedTree != NULL)
+    {
+        shardedTree->initialize();
+        return;
+    }
+    tree.clear();
+    compactTree.clear();
+    if (mvccMode)
+    {
+        mvccTree.clear();
+    }
+    invalidateSnapshot();
+}
+
+// Copy the keys into a read-optimized snapshot for the searches that follow
+template <typename Tree>
+void freezeTree(const Tree &t)
+{
+    vector<int> keys;
+    keys.reserve(t.size());
+    typename Tree::RangeCursor cursor;
+    cursor.startAtMin(t);
+    const int *key;
+    while ((key = cursor.next()) != NULL)
+    {
+        keys.push_back(*key);
+    }
+    snapshot.build(keys);
 }
 
-// Helper function to make sure is proper BST
-void ListItemsInOrder(Node *t)
+void Freeze()
 {
-    if (t == NULL)
+    if (shardedTree != NULL)
+    {
+        // shards keep answering searches themselves
         return;
-    ListItemsInOrder(t->left);
-    cout << t->data << " ";
-    ListItemsInOrder(t->right);
+    }
+    if (compactMode)
+    {
+        freezeTree(compactTree);
+    }
+    else if (mvccMode)
+    {
+        MvccTree::ReadGuard version(mvccTree, mainReader);
+        freezeTree(version);
+    }
+    else
+    {
+        freezeTree(tree);
+    }
+    snapshotValid = true;
 }
 
-// Helper function for range search
-// Is basically a recursive inorder traversal
-void ListItemsInRange(Node *t, int a, int b)
+// Print node allocator stats
+void AllocatorStats()
 {
-    if (t == NULL)
+    if (shardedTree != NULL)
+    {
+        shardedTree->allocatorStats();
+        return;
+    }
+    if (compactMode)
+    {
+        results << "live nodes: " << compactTree.size()
+                << ", node vector: " << compactTree.bytesUsed() << " bytes\n";
         return;
+    }
+    if (mvccMode)
+    {
+        MvccTree::ReadGuard version(mvccTree, mainReader);
+        results << "live keys: " << version.size()
+                << ", retired batches awaiting readers: " << mvccTree.retiredBatches() << "\n";
+        return;
+    }
+
+    SlabPool<IntTree::Node> &nodePool = tree.allocator();
+    results << "live nodes: " << nodePool.liveObjects()
+            << ", slabs: " << nodePool.slabsAllocated()
+            << " x " << nodePool.bytesPerSlab() << " bytes"
+            << (nodePool.usingHugePages() ? " (huge pages)" : "")
+            << ", bytes wasted: " << nodePool.bytesWasted() << "\n";
+}
+
+// Average of total over count, 0 if count is 0
+double perOp(unsigned long long total, unsigned long long count)
+{
+    return count == 0 ? 0.0 : (double)total / count;
+}
+
+// AVL trees are never taller than 1.4405 log2(n + 2) - 0.3277,
+// WAVL ranks stay under 2 log2(n + 1) (relaxed can drift past that
+// until its next rebuild)
+double heightBound(size_t nodes, BalanceMode mode)
+{
+    return mode == BALANCE_AVL ? 1.4405 * log2((double)nodes + 2) - 0.3277
+                               : 2 * log2((double)nodes + 1) + 1;
+}
 
-    // Recursively start in the left subtree
-    ListItemsInRange(t->left, a, b);
+// Print operation counters as JSON fields (after others, so each
+// starts with a comma)
+void printCounters(const TreeStats &stats)
+{
+    results << ", \"rotations\": {\"ll\": " << stats.llRotations
+            << ", \"rr\": " << stats.rrRotations
+            << ", \"lr\": " << stats.lrRotations
+            << ", \"rl\": " << stats.rlRotations << "}"
+            << ", \"searches\": " << stats.searches
+            << ", \"search_visits_per_op\": " << perOp(stats.searchVisits, stats.searches)
+            << ", \"inserts\": " << stats.inserts
+            << ", \"insert_visits_per_op\": " << perOp(stats.insertVisits, stats.inserts)
+            << ", \"deletes\": " << stats.erases
+            << ", \"delete_visits_per_op\": " << perOp(stats.eraseVisits, stats.erases)
+            << ", \"delete_cases\": {\"leaf\": " << stats.leafDeletes
+            << ", \"one_child\": " << stats.oneChildDeletes
+            << ", \"two_children\": " << stats.twoChildDeletes << "}"
+            << ", \"rebuilds\": " << stats.rebuilds;
+}
 
-    // if node is within range, print it
-    if (t->data >= a && t->data <= b)
+// Print tree counters & shape as one JSON object
+void Stats()
+{
+    if (shardedTree != NULL)
+    {
+        // shards' sizes & counters added up; height is the tallest one's
+        size_t nodes;
+        int height;
+        size_t bytes;
+        TreeStats counters;
+        shardedTree->stats(nodes, height, bytes, counters);
+        results << "{\"mode\": \"sharded\", \"shards\": " << shardedTree->shardCount()
+                << ", \"nodes\": " << nodes
+                << ", \"height\": " << height
+                << ", \"bytes\": " << bytes;
+        if constexpr (CommandTreePolicy::statistics)
+        {
+            printCounters(counters);
+        }
+        results << "}\n";
+        return;
+    }
+    if (mvccMode)
+    {
+        // the current version; no counters (readers don't share any),
+        // bytes include replaced nodes still waiting for readers
+        MvccTree::ReadGuard version(mvccTree, mainReader);
+        results << "{\"mode\": \"mvcc\", \"nodes\": " << version.size()
+                << ", \"height\": " << version.height()
+                << ", \"height_bound\": " << floor(heightBound(version.size(), BALANCE_AVL))
+                << ", \"bytes\": " << mvccTree.bytesUsed()
+                << ", \"retired_batches\": " << mvccTree.retiredBatches() << "}\n";
+        return;
+    }
+    if (compactMode)
     {
-        cout << t->data << ", ";
-        outputFile << t->data << ", ";
+        results << "{\"mode\": \"compact\", \"nodes\": " << compactTree.size()
+                << ", \"bytes\": " << compactTree.bytesUsed() << "}\n";
+        return;
     }
 
-    // Recursively go into the right subtree
-    ListItemsInRange(t->right, a, b);
+    size_t nodes = tree.size();
+    SlabPool<IntTree::Node> &nodePool = tree.allocator();
+
+    results << "{\"nodes\": " << nodes
+            << ", \"height\": " << tree.height()
+            << ", \"height_bound\": " << floor(heightBound(nodes, tree.balanceMode()))
+            << ", \"bytes\": " << nodePool.slabsAllocated() * nodePool.bytesPerSlab();
+    const LookupCache<int, IntTree::Node *> &cache = tree.lookupCache();
+    if (cache.enabled())
+    {
+        results << ", \"cache\": {\"entries\": " << cache.capacity()
+                << ", \"hits\": " << cache.hits()
+                << ", \"misses\": " << cache.misses() << "}";
+    }
+    if (tree.lazyDeleteRatio() > 0)
+    {
+        results << ", \"lazy_delete\": {\"ratio\": " << tree.lazyDeleteRatio()
+                << ", \"tombstones\": " << tree.tombstoneCount();
+        if constexpr (CommandTreePolicy::statistics)
+        {
+            const TreeStats &stats = tree.statistics();
+            results << ", \"compactions\": " << stats.compactions
+                    << ", \"purged\": " << stats.tombstonesPurged
+                    << ", \"compact_ms\": " << stats.compactNanos / 1e6;
+        }
+        results << "}";
+    }
+    if constexpr (CommandTreePolicy::statistics)
+    {
+        printCounters(tree.statistics());
+    }
+    results << "}\n";
 }
 
 // Search for a specific key.
 void Search(int key)
 {
-    // start searching at root
-    Node *current = AvlTree;
-    bool foundKey = false; // indicator if key was found
+    if (shardedTree != NULL)
+    {
+        shardedTree->search(key);
+        return;
+    }
+
+    bool found;
+    if (snapshotValid)
+    {
+        found = snapshot.contains(key);
+    }
+    else if (mvccMode)
+    {
+        MvccTree::ReadGuard version(mvccTree, mainReader);
+        found = version.contains(key);
+    }
+    else
+    {
+        found = compactMode ? compactTree.contains(key) : tree.contains(key);
+    }
+
+    if (found)
+    {
+        results << key << "\n";
+    }
+    else
+    {
+        // search was unsuccesful (or tree is empty)
+        results << "NULL\n";
+    }
+}
+
+// Search for many keys at once; prints one line per key, in order.
+// Lookups run interleaved (see containsBatch), so their cache misses
+// overlap; the snapshot is already prefetched & just loops.
+void SearchBatch(const int *keys, size_t count)
+{
+    bool found[MAX_COMMAND_ARGS];
+
+    if (count == 1 || shardedTree != NULL)
+    {
+        // nothing to overlap with (shards queue each key separately)
+        for (size_t i = 0; i < count; i++)
+        {
+            Search(keys[i]);
+        }
+        return;
+    }
+
+    for (size_t base = 0; base < count; base += MAX_COMMAND_ARGS)
+    {
+        size_t n = min(count - base, (size_t)MAX_COMMAND_ARGS);
+        if (snapshotValid)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                found[i] = snapshot.contains(keys[base + i]);
+            }
+        }
+        else if (compactMode)
+        {
+            compactTree.containsBatch(keys + base, n, found);
+        }
+        else if (mvccMode)
+        {
+            // the whole batch sees one version
+            MvccTree::ReadGuard version(mvccTree, mainReader);
+            for (size_t i = 0; i < n; i++)
+            {
+                found[i] = version.contains(keys[base + i]);
+            }
+        }
+        else
+        {
+            tree.containsBatch(keys + base, n, found);
+        }
+
+        for (size_t i = 0; i < n; i++)
+        {
+            if (found[i])
+            {
+                results << keys[base + i] << "\n";
+            }
+            else
+            {
+                results << "NULL\n";
+            }
+        }
+    }
+}
+
+// Range search (values between a and b, inclusive)
+// If limit > 0, at most limit keys are listed; if more keys remain in
+// range, "NEXT <key>" is printed as a resume token, and the caller
+// continues with Search(key, b, limit)
+template <typename Tree>
+void listRange(const Tree &t, int a, int b, int limit)
+{
+    if (t.empty())
+    {
+        // Nothing in AVL Tree; is empty
+        results << "NULL\n";
+        return;
+    }
+
+    // AVL Tree is not empty; walk the keys in range using a cursor
+    typename Tree::RangeCursor cursor;
+    const int *key;
+    int count = 0;
+    cursor.start(t, a, b);
+
+    while ((limit <= 0 || count < limit) && (key = cursor.next()) != NULL)
+    {
+        results << *key << ", ";
+        count++;
+    }
+
+    // hit the limit with keys left over; hand back a resume token
+    if (limit > 0 && (key = cursor.peek()) != NULL)
+    {
+        results << "NEXT " << *key;
+    }
+    results << "\n";
+}
+
+void Search(int a, int b, int limit = 0)
+{
+    if (shardedTree != NULL)
+    {
+        shardedTree->searchRange(a, b, limit);
+    }
+    else if (snapshotValid)
+    {
+        listRange(snapshot, a, b, limit);
+    }
+    else if (compactMode)
+    {
+        listRange(compactTree, a, b, limit);
+    }
+    else if (mvccMode)
+    {
+        MvccTree::ReadGuard version(mvccTree, mainReader);
+        listRange(version, a, b, limit);
+    }
+    else
+    {
+        listRange(tree, a, b, limit);
+    }
+}
+
+// ORDER STATISTICS
+// all use the cached subtree sizes, so each is a single O(log n) descent
+// (compact nodes have no sizes, so in compact mode they walk the keys
+// with a cursor instead: O(log n + keys walked))
+
+// Count keys between a and b, inclusive
+void Count(int a, int b)
+{
+    if (shardedTree != NULL)
+    {
+        shardedTree->count(a, b);
+        return;
+    }
+    if (compactMode)
+    {
+        size_t count = 0;
+        CompactAvlTree<int>::RangeCursor cursor;
+        cursor.start(compactTree, a, b);
+        while (cursor.next() != NULL)
+        {
+            count++;
+        }
+        results << count << "\n";
+        return;
+    }
+    if (mvccMode)
+    {
+        MvccTree::ReadGuard version(mvccTree, mainReader);
+        size_t below = version.countBelow(a, false);
+        size_t upTo = version.countBelow(b, true);
+        results << (upTo > below ? upTo - below : 0) << "\n";
+        return;
+    }
+    results << tree.countRange(a, b) << "\n";
+}
+
+// Rank of key: number of keys <= key
+// (so Select(Rank(key)) is key whenever key is in the tree)
+void Rank(int key)
+{
+    if (shardedTree != NULL)
+    {
+        shardedTree->rank(key);
+        return;
+    }
+    if (compactMode)
+    {
+        size_t rank = 0;
+        CompactAvlTree<int>::RangeCursor cursor;
+        cursor.startAtMin(compactTree);
+        const int *next;
+        while ((next = cursor.next()) != NULL && *next <= key)
+        {
+            rank++;
+        }
+        results << rank << "\n";
+        return;
+    }
+    if (mvccMode)
+    {
+        MvccTree::ReadGuard version(mvccTree, mainReader);
+        results << version.countBelow(key, true) << "\n";
+        return;
+    }
+    results << tree.rank(key) << "\n";
+}
+
+// Select the k-th smallest key (k = 1 is the minimum)
+void Select(int k)
+{
+    if (shardedTree != NULL)
+    {
+        shardedTree->select(k);
+        return;
+    }
+    const int *key = NULL;
+    if (mvccMode)
+    {
+        // print while the version is still pinned
+        MvccTree::ReadGuard version(mvccTree, mainReader);
+        key = k >= 1 ? version.select(k) : NULL;
+        results << (key == NULL ? "NULL" : to_string(*key)) << "\n";
+        return;
+    }
+    if (compactMode)
+    {
+        CompactAvlTree<int>::RangeCursor cursor;
+        cursor.startAtMin(compactTree);
+        int i = 0;
+        while (i < k && (key = cursor.next()) != NULL)
+        {
+            i++;
+        }
+    }
+    else if (k >= 1)
+    {
+        key = tree.select(k);
+    }
+    if (key == NULL)
+    {
+        // no such key
+        results << "NULL\n";
+        return;
+    }
+    results << *key << "\n";
+}
+
+// AGGREGATES
+
+// what Aggregate(op,a,b) computes over the keys in [a, b]
+enum AggregateOp
+{
+    AGGREGATE_SUM,
+    AGGREGATE_MIN,
+    AGGREGATE_MAX,
+    AGGREGATE_COUNT
+};
+
+// count, sum, min & max of the keys in [a, b] by walking them with a
+// cursor: O(log n + keys in range), for trees without summaries
+template <typename Tree>
+void walkSummary(const Tree &t, int a, int b, size_t &count, long long &sum, int &min, int &max)
+{
+    typename Tree::RangeCursor cursor;
+    cursor.start(t, a, b);
+    const int *key;
+    while ((key = cursor.next()) != NULL)
+    {
+        if (count == 0)
+        {
+            min = *key;
+        }
+        max = *key;
+        count++;
+        sum += *key;
+    }
+}
+
+// same from the default tree in O(log n): the sum from the subtree sums
+// along two paths, count from subtree sizes, and min & max are just the
+// range's first & last keys (Ceiling & Floor)
+template <typename Tree>
+void treeSummary(const Tree &t, int a, int b, size_t &count, long long &sum, int &min, int &max)
+{
+    if constexpr (Tree::hasAggregate)
+    {
+        count = t.countRange(a, b);
+        if (count > 0)
+        {
+            sum = t.aggregateRange(a, b);
+            min = *t.ceiling(a);
+            max = *t.floor(b);
+        }
+    }
+    else
+    {
+        walkSummary(t, a, b, count, sum, min, max);
+    }
+}
+
+// Print the sum, min, max or count of the keys in [a, b]; min & max
+// are NULL for an empty range, sum & count 0
+void Aggregate(AggregateOp op, int a, int b)
+{
+    size_t count = 0;
+    long long sum = 0;
+    int min = 0;
+    int max = 0;
+    if (shardedTree != NULL)
+    {
+        shardedTree->summarize(a, b, count, sum, min, max);
+    }
+    else if (a > b)
+    {
+        // empty range
+    }
+    else if (compactMode)
+    {
+        walkSummary(compactTree, a, b, count, sum, min, max);
+    }
+    else if (mvccMode)
+    {
+        MvccTree::ReadGuard version(mvccTree, mainReader);
+        walkSummary(version, a, b, count, sum, min, max);
+    }
+    else
+    {
+        treeSummary(tree, a, b, count, sum, min, max);
+    }
+
+    if (op == AGGREGATE_SUM)
+    {
+        results << sum << "\n";
+    }
+    else if (op == AGGREGATE_COUNT)
+    {
+        results << count << "\n";
+    }
+    else if (count == 0)
+    {
+        results << "NULL\n";
+    }
+    else
+    {
+        results << (op == AGGREGATE_MIN ? min : max) << "\n";
+    }
+}
+
+// NEAREST KEYS
+// closest key to key, for when Search(key) would miss; one O(log n)
+// descent each (two in mvcc mode: Rank then Select)
+
+// Print the closest key below (or above) key, or key itself if
+// inclusive; NULL if there's none
+void printNearest(int key, bool below, bool inclusive)
+{
+    if (shardedTree != NULL)
+    {
+        shardedTree->nearest(key, below, inclusive);
+        return;
+    }
+    const int *found;
+    if (mvccMode)
+    {
+        // print while the version is still pinned
+        MvccTree::ReadGuard version(mvccTree, mainReader);
+        size_t k = below ? version.countBelow(key, inclusive) : version.countBelow(key, !inclusive) + 1;
+        found = version.select(k);
+        results << (found == NULL ? "NULL" : to_string(*found)) << "\n";
+        return;
+    }
+    if (compactMode)
+    {
+        found = compactTree.nearest(key, below, inclusive);
+    }
+    else if (below)
+    {
+        found = inclusive ? tree.floor(key) : tree.predecessor(key);
+    }
+    else
+    {
+        found = inclusive ? tree.ceiling(key) : tree.successor(key);
+    }
+    if (found == NULL)
+    {
+        results << "NULL\n";
+        return;
+    }
+    results << *found << "\n";
+}
+
+// largest key <= key
+void Floor(int key) { printNearest(key, true, true); }
+// smallest key >= key
+void Ceiling(int key) { printNearest(key, false, true); }
+// largest key < key
+void Pred(int key) { printNearest(key, true, false); }
+// smallest key > key
+void Succ(int key) { printNearest(key, false, false); }
+
+// Insert a new key
+void Insert(int key)
+{
+    if (!logMutation(WAL_INSERT, key))
+    {
+        return;
+    }
+    invalidateSnapshot();
+    if (shardedTree != NULL)
+    {
+        shardedTree->insert(key);
+        return;
+    }
+    if (compactMode)
+    {
+        compactTree.insert(key);
+        return;
+    }
+    if (mvccMode)
+    {
+        mvccTree.insert(key);
+        return;
+    }
+    tree.insert(key);
+}
+
+// Delete a key
+void Delete(int key)
+{
+    if (!logMutation(WAL_DELETE, key))
+    {
+        return;
+    }
+    invalidateSnapshot();
+    if (shardedTree != NULL)
+    {
+        shardedTree->erase(key);
+        return;
+    }
+    if (compactMode)
+    {
+        compactTree.erase(key);
+        return;
+    }
+    if (mvccMode)
+    {
+        mvccTree.erase(key);
+        return;
+    }
+    tree.erase(key);
+}
+
+// VALUES
+// only the default tree keeps a value per key; each command is one
+// descent, rebalancing only if the key is new (the key-only snapshot
+// is only stale then too)
+
+// false (with a message) in the key-only modes
+bool valuesKept(const Command &command)
+{
+    if (shardedTree != NULL || compactMode || mvccMode)
+    {
+        cerr << "Line " << command.lineNumber << ": values are only kept by the default tree"
+             << " (not with --compact, --mvcc or --shards). Moving on to next command." << endl;
+        return false;
+    }
+    return true;
+}
+
+// Set key's value, adding key if needed
+void Upsert(int key, int value)
+{
+    if (!logValue(key, value))
+    {
+        return;
+    }
+    if (tree.upsert(key, value))
+    {
+        invalidateSnapshot();
+    }
+}
+
+// Print key's value, adding key with value first if needed
+void GetOrInsert(int key, int value)
+{
+    // with a log, look first: only a new key is logged (before it's added)
+    if (walLogging && tree.find(key) == NULL && !logValue(key, value))
+    {
+        return;
+    }
+    size_t before = tree.size();
+    int stored = tree.getOrInsert(key, value);
+    if (tree.size() != before)
+    {
+        invalidateSnapshot();
+    }
+    results << stored << "\n";
+}
+
+// Add delta to key's value (adding key with value delta if needed) &
+// print the new value
+void Increment(int key, int delta)
+{
+    if (walLogging)
+    {
+        // logged (first) as the value it will end up with, so replay
+        // stays idempotent; that takes a lookup before the update
+        int *current = tree.find(key);
+        if (!logValue(key, current != NULL ? *current + delta : delta))
+        {
+            return;
+        }
+    }
+    size_t before = tree.size();
+    int value = tree.increment(key, delta);
+    if (tree.size() != before)
+    {
+        invalidateSnapshot();
+    }
+    results << value << "\n";
+}
+
+// BULK LOAD
+
+// Helper function for bulk load
+// Reads every integer in a file (separated by whitespace and/or commas)
+bool readKeyFile(const string &fileName, vector<int> &keys)
+{
+    ifstream keyFile(fileName.c_str(), ios::binary);
+    if (!keyFile)
+    {
+        return false;
+    }
+
+    // slurp the whole file, then pick the integers out of it
+    string contents((istreambuf_iterator<char>(keyFile)), istreambuf_iterator<char>());
+    const char *p = contents.c_str();
+    while (*p != '\0')
+    {
+        char *end;
+        long value = strtol(p, &end, 10);
+        if (end == p)
+        {
+            // not a number; skip separator
+            p++;
+        }
+        else
+        {
+            keys.push_back((int)value);
+            p = end;
+        }
+    }
+    return true;
+}
+
+// Insert every key in a file at once.
+// Keys are sorted & deduplicated, merged with the keys already in the
+// tree, and the tree is relinked balanced in O(n) (plus the sort),
+// with no per-key descent or rotation.
+void BulkInsert(const string &fileName)
+{
+    vector<int> newKeys;
+    if (!readKeyFile(fileName, newKeys))
+    {
+        cerr << "Could not open " << fileName << endl;
+        return;
+    }
+    invalidateSnapshot();
+    if (shardedTree != NULL)
+    {
+        shardedTree->bulkInsert(std::move(newKeys));
+        return;
+    }
+    if (compactMode)
+    {
+        compactTree.bulkInsert(std::move(newKeys));
+        return;
+    }
+    if (mvccMode)
+    {
+        mvccTree.bulkInsert(std::move(newKeys));
+        return;
+    }
+    tree.bulkInsert(std::move(newKeys));
+}
+
+// BACKGROUND READERS
+
+// set once the input is done
+atomic<bool> stopReaders(false);
+
+// Body of a --readers thread: pins the current version, runs a burst of
+// random lookups on it, unpins & repeats, so versions keep moving on
+// under it while the main thread applies Insert/Delete
+void readerLoop(unsigned int seed, size_t *lookups, size_t *hits)
+{
+    int slot = mvccTree.registerReader();
+    if (slot < 0)
+    {
+        return;
+    }
+
+    size_t done = 0;
+    size_t found = 0;
+    unsigned int x = seed | 1;
+    while (!stopReaders.load(memory_order_relaxed))
+    {
+        MvccTree::ReadGuard version(mvccTree, slot);
+        for (int i = 0; i < 64; i++)
+        {
+            // xorshift; keys in [0, 2^20)
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            found += version.contains((int)(x & 0xFFFFF));
+        }
+        done += 64;
+    }
+    mvccTree.unregisterReader(slot);
+    *lookups = done;
+    *hits = found;
+}
+
+// SAVE & LOAD
+
+// Append every key of t, in order, to a key file
+template <typename Tree>
+void writeKeys(const Tree &t, KeyFileWriter<int> &writer)
+{
+    typename Tree::RangeCursor cursor;
+    cursor.startAtMin(t);
+    const int *key;
+    while ((key = cursor.next()) != NULL)
+    {
+        writer.append(*key);
+    }
+}
+
+// Write the keys to a binary snapshot file (see key_file.h)
+bool Save(const string &fileName)
+{
+    KeyFileWriter<int> writer;
+    if (!writer.open(fileName))
+    {
+        cerr << "Could not create " << fileName << endl;
+        return false;
+    }
 
-    if (current == NULL)
+    if (shardedTree != NULL)
     {
-        // Nothing in AVL Tree; is empty
-        cout << "NULL" << endl;
-        outputFile << "NULL\n";
+        vector<int> keys;
+        shardedTree->sortedKeys(keys);
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            writer.append(keys[i]);
+        }
+    }
+    else if (compactMode)
+    {
+        writeKeys(compactTree, writer);
+    }
+    else if (mvccMode)
+    {
+        MvccTree::ReadGuard version(mvccTree, mainReader);
+        writeKeys(version, writer);
     }
     else
     {
-        // AVL Tree is not empty; search
-        while (current != NULL)
+        writeKeys(tree, writer);
+        // then the values, in the same order
+        for (IntTree::Iterator it = tree.begin(); it != tree.end(); ++it)
         {
-            // key is greater than current node
-            if (current->data > key)
-            {
-                current = current->left;
-            }
-            // key is less than current node
-            else if (current->data < key)
-            {
-                current = current->right;
-            }
-            // key found! print it.
-            else
-            {
-                cout << current->data << endl;
-                outputFile << current->data << endl;
-                current = NULL; // to exit while loop
-                foundKey = true;
-            }
+            writer.appendValue(it.value());
         }
+    }
 
-        // search was unsuccesful
-        if (!foundKey)
-        {
-            cout << "NULL" << endl;
-            outputFile << "NULL\n";
-        }
+    if (!writer.commit())
+    {
+        cerr << "Could not write " << fileName << endl;
+        return false;
     }
+    return true;
 }
 
-// Range search (values between a and b, inclusive)
-void Search(int a, int b)
+// Replace the tree with the keys of a Save file.
+// The file is mapped, checked & the tree built straight from the
+// sorted keys in O(n); a bad file leaves the tree as it was.
+bool Load(const string &fileName)
 {
+    KeyFileReader<int> reader;
+    if (!reader.open(fileName))
+    {
+        cerr << "Could not load " << fileName << ": " << reader.error() << endl;
+        return false;
+    }
+    const int *keys = reader.keys();
+    size_t count = reader.count();
+    for (size_t i = 1; i < count; i++)
+    {
+        if (keys[i - 1] >= keys[i])
+        {
+            cerr << "Could not load " << fileName << ": keys out of order" << endl;
+            return false;
+        }
+    }
 
-    // start at root of AVL tree
-    Node *current = AvlTree;
-
-    if (current == NULL)
+    invalidateSnapshot();
+    if (shardedTree != NULL)
     {
-        // Nothing in AVL Tree; is empty
-        cout << "NULL" << endl;
-        outputFile << "NULL\n";
+        shardedTree->initialize();
+        shardedTree->bulkInsert(vector<int>(keys, keys + count));
+    }
+    else if (compactMode)
+    {
+        compactTree.clear();
+        compactTree.bulkInsert(vector<int>(keys, keys + count));
+    }
+    else if (mvccMode)
+    {
+        mvccTree.clear();
+        mvccTree.bulkInsert(vector<int>(keys, keys + count));
     }
     else
     {
-        // AVL Tree is not empty; search for items in range using helper function
-        ListItemsInRange(AvlTree, a, b);
-        cout << endl;
-        outputFile << "\n";
+        tree.assignSorted(keys, count, reader.values<int>());
     }
+    return true;
 }
 
-// helper function for creating new node during Insert
-Node *createNewNode(int key)
-{
-    // allocate memory for new node
-    Node *newNode = new Node;
+// RANGE DELETE & MERGE
+// the default tree splits the range out & joins the rest back in
+// O(log n) (+ O(k) to free the k removed nodes); the other modes
+// fall back to one erase per key
 
-    // set node properties; left & right children will be empty (null)
-    newNode->data = key;
-    // helps to re-identify root if necessary during rebalancing
-    newNode->isRoot = false;
-    newNode->left = NULL;
-    newNode->right = NULL;
-    return newNode;
+// Append keys of t in [a, b] to keys
+template <typename Tree>
+void collectRange(const Tree &t, int a, int b, vector<int> &keys)
+{
+    typename Tree::RangeCursor cursor;
+    cursor.start(t, a, b);
+    const int *key;
+    while ((key = cursor.next()) != NULL)
+    {
+        keys.push_back(*key);
+    }
 }
 
-// ROTATIONS
-
-// for RR imbalance; moves right child up (left rotation)
-void RR_imbalance(Node *n, Node *parent)
+// Remove every key in [a, b], appending them (in order) to removed;
+// false if it couldn't be logged (nothing is removed then)
+bool removeRange(int a, int b, vector<int> &removed)
 {
-
-    cout << "RR IMBALANCE ON " << n->data << endl;
-    Node *oldParent = n;
-    Node *rightChild = n->right;
-
-    // make unbalanced node's right child its parent, rearrange pointers
-    oldParent->right = rightChild->left;
-    rightChild->left = oldParent;
-
-    // if unbalanced node has a parent, make parent point to
-    // unbalanced node's right child
-    // (which child depends on if unbalanced node was left or right child)
-    if (parent != NULL && parent->right == oldParent)
+    // logged as one record, whatever the number of keys
+    if (!logDeleteRange(a, b))
     {
-        parent->right = rightChild;
+        return false;
     }
-    else if (parent != NULL && parent->left == oldParent)
+    invalidateSnapshot();
+    if (shardedTree != NULL)
     {
-        parent->left = rightChild;
+        shardedTree->extractRange(a, b, removed);
     }
-
-    // if unbalanced node was originally the root,
-    // make right child the new root (since is now parent)
-    if (n->isRoot)
+    else if (compactMode)
+    {
+        collectRange(compactTree, a, b, removed);
+        for (size_t i = 0; i < removed.size(); i++)
+        {
+            compactTree.erase(removed[i]);
+        }
+    }
+    else if (mvccMode)
+    {
+        {
+            MvccTree::ReadGuard version(mvccTree, mainReader);
+            collectRange(version, a, b, removed);
+        }
+        for (size_t i = 0; i < removed.size(); i++)
+        {
+            mvccTree.erase(removed[i]);
+        }
+    }
+    else
     {
-        oldParent->isRoot = false;
-        rightChild->isRoot = true;
-        AvlTree = rightChild;
+        tree.extractRange(a, b, [&removed](int &&key, int &&)
+                          { removed.push_back(key); });
     }
+    return true;
 }
 
-// for LL imbalance; move left child up; right rotation
-void LL_imbalance(Node *n, Node *parent)
+void DeleteRange(int a, int b)
 {
-    cout << "LL IMBALANCE ON " << n->data << endl;
-    Node *oldParent = n;
-    Node *leftChild = n->left;
-
-    // make unbalanced node's left child its parent, rearrange pointers
-    oldParent->left = leftChild->right;
-    leftChild->right = oldParent;
+    vector<int> removed;
+    removeRange(a, b, removed);
+}
 
-    // if unbalanced node has a parent, make parent point to
-    // unbalanced node's left child
-    // (which child depends on if unbalanced node was left or right child)
-    if (parent != NULL && parent->left == oldParent)
+// Remove & print every key in [a, b]
+void ExtractRange(int a, int b)
+{
+    vector<int> removed;
+    if (!removeRange(a, b, removed))
     {
-        parent->left = leftChild;
+        return;
     }
-    else if (parent != NULL && parent->right == oldParent)
+    if (removed.empty())
     {
-        parent->right = leftChild;
+        results << "NULL\n";
+        return;
     }
-
-    // if unbalanced node was originally the root,
-    // make left child the new root (since is now parent)
-    if (n->isRoot)
+    for (size_t i = 0; i < removed.size(); i++)
     {
-        oldParent->isRoot = false;
-        leftChild->isRoot = true;
-        AvlTree = leftChild;
+        results << removed[i] << ", ";
     }
+    results << "\n";
 }
 
-void LR_imbalance(Node *n, Node *parent)
+// Add the keys of a Save file to the tree (a union, unlike Load).
+// O(m log(n / m + 1)) for m keys into n in the default mode.
+bool Merge(const string &fileName)
 {
-    cout << "LR IMBALANCE ON " << n->data << endl;
-    Node *child = n->left;
-    Node *grandchild = n->left->right;
-
-    // if unbalanced node has a parent, make parent point to
-    // unbalanced node's grandchild
-    // (which child depends on if unbalanced node was left or right child)
-    if (parent != NULL && parent->left == n)
+    KeyFileReader<int> reader;
+    if (!reader.open(fileName))
     {
-        parent->left = grandchild;
+        cerr << "Could not merge " << fileName << ": " << reader.error() << endl;
+        return false;
     }
-    else if (parent != NULL && parent->right == n)
+    const int *keys = reader.keys();
+    size_t count = reader.count();
+    for (size_t i = 1; i < count; i++)
     {
-        parent->right = grandchild;
+        if (keys[i - 1] >= keys[i])
+        {
+            cerr << "Could not merge " << fileName << ": keys out of order" << endl;
+            return false;
+        }
     }
 
-    // rearrange pointers, bringing grandchild up
-    // and making original unbalanced node & its child
-    // children of grandchild
-    child->right = grandchild->left;
-    grandchild->left = child;
-    n->left = grandchild->right;
-    grandchild->right = n;
-
-    // if unbalanced node was originally the root,
-    // make grandchild the new root (since is now parent)
-    if (n->isRoot)
+    invalidateSnapshot();
+    if (shardedTree != NULL)
+    {
+        shardedTree->bulkInsert(vector<int>(keys, keys + count));
+    }
+    else if (compactMode)
+    {
+        compactTree.bulkInsert(vector<int>(keys, keys + count));
+    }
+    else if (mvccMode)
+    {
+        mvccTree.bulkInsert(vector<int>(keys, keys + count));
+    }
+    else
     {
-        n->isRoot = false;
-        grandchild->isRoot = true;
-        AvlTree = grandchild;
+        tree.mergeSorted(keys, count, reader.values<int>());
     }
+    return true;
 }
 
-void RL_imbalance(Node *n, Node *parent)
-{
-    cout << "RL IMBALANCE ON " << n->data << endl;
-    Node *child = n->right;
-    Node *grandchild = n->right->left;
+// CHECKPOINT & RECOVERY (--wal)
 
-    // if unbalanced node has a parent, make parent point to
-    // unbalanced node's grandchild
-    // (which child depends on if unbalanced node was left or right child)
-    if (parent != NULL && parent->right == n)
+// Save the tree & empty the log it makes redundant. If that fails the
+// log still has every logged change, so the tree can be recovered
+// without the checkpoint. BulkInsert, Load & Merge aren't logged
+// (unlogged): their changes only survive in the checkpoint, so then a
+// failure fails the log too & no more commands are applied
+void Checkpoint(bool unlogged)
+{
+    if (!walLogging)
     {
-        parent->right = grandchild;
+        return;
     }
-    else if (parent != NULL && parent->left == n)
+    // a failed sync fails the log by itself
+    if (!wal.sync())
     {
-        parent->left = grandchild;
+        return;
     }
-
-    // rearrange pointers, bringing grandchild up
-    // and making original unbalanced node & its child
-    // children of grandchild
-    child->left = grandchild->right;
-    grandchild->right = child;
-    n->right = grandchild->left;
-    grandchild->left = n;
-
-    // if unbalanced node was originally the root,
-    // make grandchild the new root (since is now parent)
-    if (n->isRoot)
+    if (Save(walPath + ".ckpt"))
     {
-        n->isRoot = false;
-        grandchild->isRoot = true;
-        AvlTree = grandchild;
+        wal.reset();
+    }
+    else if (unlogged)
+    {
+        wal.fail("checkpoint failed; the last bulk change isn't durable");
     }
 }
 
-// Helper function for checking imbalances
-// Returns height of a specific node
-int getHeight(Node *n)
+// apply one replayed log record
+void replayRecord(WalOp op, int key, int value)
 {
-    if (n == NULL)
+    switch (op)
     {
-        // if empty tree, height is 0
-        return 0;
+    case WAL_SET:
+        Upsert(key, value);
+        break;
+    case WAL_DELETE_RANGE:
+        DeleteRange(key, value);
+        break;
+    case WAL_VALUE:
+        // replay hands pairs over as one
+        break;
+    case WAL_INSERT:
+        Insert(key);
+        break;
+    case WAL_DELETE:
+        Delete(key);
+        break;
+    case WAL_CLEAR:
+        Initialize();
+        break;
     }
-    if (n->left == NULL && n->right == NULL)
+}
+
+// Rebuild the tree from the last checkpoint plus the log tail
+bool recover(size_t syncOps, unsigned int syncMillis)
+{
+    string checkpointPath = walPath + ".ckpt";
+    bool fromCheckpoint = access(checkpointPath.c_str(), F_OK) == 0;
+    if (fromCheckpoint && !Load(checkpointPath))
     {
-        // if node with no children, height is 1
-        return 1;
+        return false;
     }
-    else
+    if (!wal.open(walPath, syncOps, syncMillis))
     {
-        // recursively find left & right subtrees' heights
-        int left_height = getHeight(n->left);
-        int right_height = getHeight(n->right);
-
-        // get the max between the two
-        int max_height = max(left_height, right_height);
-        return max_height + 1;
+        cerr << "Could not open write-ahead log " << walPath << endl;
+        return false;
     }
-
-    return 0;
+    size_t replayed = wal.replay(replayRecord);
+    trace << "Recovered from " << (fromCheckpoint ? "checkpoint" : "empty tree")
+          << " plus " << replayed << " log records\n";
+    walLogging = true;
+    return true;
 }
 
-// Rebalancing function.
-// Checks for imbalances, & directs rotations as necessary
-void checkImbalance(stack<Node *> trackStack)
+int main(int argc, char **argv)
 {
-    Node *current = NULL;
-    Node *parent = NULL;
-    int current_balance_factor;
-    int left_balance_factor;
-    int right_balance_factor;
-
-    // go through entire track stack (backtrace)
-    while (!trackStack.empty())
+    CommandParser parser;
+    string fileName;
+    Verbosity verbosity = VERBOSITY_RESULTS;
+    bool fileOnly = false;
+    int readerThreads = 0;
+    int shardCount = 0;
+    size_t walSyncOps = 4096;
+    unsigned int walSyncMillis = 10;
+    bool followInput = false;
+    size_t streamBufferBytes = 4 << 20;
+    // the last option given that only tunes the default tree
+    const char *treeOption = NULL;
+
+    // get input file name & options from command line
+    for (int i = 1; i < argc; ++i)
     {
-        // get first item in track stack
-        current = trackStack.top();
-        // pop this item off stack for next iteration of while loop
-        trackStack.pop();
-
-        // calculate this node's balance factor using
-        // getHeight helper function
-        current_balance_factor = getHeight(current->left) - getHeight(current->right);
-
-        // if node has left/right children, get those subtrees' balance factors
-        if (current->left)
+        string arg = argv[i];
+        if (arg == "--hugepages")
         {
-            left_balance_factor = getHeight(current->left->left) - getHeight(current->left->right);
+            // back node slabs with huge pages
+            tree.allocator().setHugePages(true);
         }
-        if (current->right)
+        else if (arg == "--cache" && i + 1 < argc)
         {
-            right_balance_factor = getHeight(current->right->left) - getHeight(current->right->right);
+            // remember the last ~N lookups so hot keys skip the descent
+            tree.enableCache(strtoul(argv[++i], NULL, 10));
+            treeOption = "--cache";
         }
-
-        // the following comparisons look at current node's balance factor
-        // and its children's to classify imbalances
-
-        // LL imbalance
-        if (current_balance_factor == 2 && left_balance_factor == 1)
+        else if (arg == "--lazy-delete" && i + 1 < argc)
         {
-            // if there is another item on the
-            // track stack, current node has a parent
-            if (!trackStack.empty())
-            {
-                parent = trackStack.top();
-            }
-            LL_imbalance(current, parent);
+            // Delete leaves tombstones; compact once they're this
+            // fraction of the nodes
+            tree.setLazyDelete(atof(argv[++i]));
+            treeOption = "--lazy-delete";
         }
-        // RR imbalance
-        else if (current_balance_factor == -2 && right_balance_factor == -1)
+        else if (arg == "--compact")
         {
-            // if there is another item on the
-            // track stack, current node has a parent
-            if (!trackStack.empty())
-            {
-                parent = trackStack.top();
-            }
-            RR_imbalance(current, parent);
+            // store nodes compactly in one vector
+            compactMode = true;
         }
-        // LR imbalance
-        else if (current_balance_factor == 2 && left_balance_factor == -1)
+        else if (arg == "--mvcc")
         {
-            // if there is another item on the
-            // track stack, current node has a parent
-            if (!trackStack.empty())
-            {
-                parent = trackStack.top();
-            }
-            LR_imbalance(current, parent);
+            // copy-on-write versions; reads never block writes
+            mvccMode = true;
         }
-        // RL imbalance
-        else if (current_balance_factor == -2 && right_balance_factor == 1)
+        else if (arg == "--readers" && i + 1 < argc)
         {
-            // if there is another item on the
-            // track stack, current node has a parent
-            if (!trackStack.empty())
-            {
-                parent = trackStack.top();
-            }
-            RL_imbalance(current, parent);
+            // run N lock-free reader threads alongside the commands
+            readerThreads = atoi(argv[++i]);
+            mvccMode = true;
         }
-    }
-}
-
-// Insert a new node
-void Insert(int key)
-{
-    Node *current = AvlTree;
-    Node *parent = NULL;
-    bool isLeftChild;
-    bool isDuplicate = false;
-
-    // use to keep track of path taken to Insert new node
-    // Will use track stack to back trace nodes and
-    // check for any imbalances introduced
-    stack<Node *> trackStack;
-
-    if (current == NULL)
-    {
-        // Empty AVL tree, insert at root
-        AvlTree = createNewNode(key);
-        AvlTree->isRoot = true;
-    }
-    else
-    {
-        // Non-empty AVL tree, find where to insert
-        // as traverse through tree, push keys visited
-        // onto the track stack
-        // keep track of which child to properly
-        // connect parent ptr to newly inserted node later
-        while (current != NULL)
+        else if (arg == "--shards" && i + 1 < argc)
+        {
+            // split the keys over N trees, one thread each
+            shardCount = atoi(argv[++i]);
+        }
+        else if (arg == "--balance" && i + 1 < argc)
         {
-            if (current->data > key)
+            // avl, wavl or relaxed rebalancing
+            string mode = argv[++i];
+            treeOption = "--balance";
+            if (mode == "wavl")
             {
-                trackStack.push(current);
-                parent = current;
-                current = current->left;
-                isLeftChild = true;
+                tree.setBalance(BALANCE_WAVL);
             }
-            else if (current->data < key)
+            else if (mode == "relaxed")
             {
-                trackStack.push(current);
-                parent = current;
-                current = current->right;
-                isLeftChild = false;
+                tree.setBalance(BALANCE_RELAXED);
             }
-            else
+            else if (mode != "avl")
             {
-                // no duplicates allowed.
-                isDuplicate = true;
-                current = NULL;
+                cerr << "Unknown balance mode " << mode << endl;
+                return 1;
             }
         }
-
-        // only insert if not duplicate
-        if (!isDuplicate)
+        else if (arg == "--wal" && i + 1 < argc)
         {
-            current = createNewNode(key);
-            if (isLeftChild)
-            {
-                parent->left = current;
-                trackStack.push(current);
-            }
-            else
-            {
-                parent->right = current;
-                trackStack.push(current);
-            }
+            // log mutations to this file & recover from it on startup
+            walPath = argv[++i];
+        }
+        else if (arg == "--wal-sync-ops" && i + 1 < argc)
+        {
+            // group commit: fdatasync once this many records are pending...
+            walSyncOps = strtoul(argv[++i], NULL, 10);
+        }
+        else if (arg == "--wal-sync-ms" && i + 1 < argc)
+        {
+            // ...or the oldest pending one is this old
+            walSyncMillis = strtoul(argv[++i], NULL, 10);
+        }
+        else if (arg == "--checkpoint-ops" && i + 1 < argc)
+        {
+            checkpointEvery = strtoul(argv[++i], NULL, 10);
+        }
+        else if (arg == "--stream")
+        {
+            // read the input on a background thread instead of mapping it
+            streaming = true;
         }
+        else if (arg == "--follow")
+        {
+            // stream a file that's still being written, until SIGINT/SIGTERM
+            streaming = true;
+            followInput = true;
+        }
+        else if (arg == "--stream-buffer" && i + 1 < argc)
+        {
+            // bytes per input buffer (there are two)
+            streamBufferBytes = strtoul(argv[++i], NULL, 10);
+        }
+        else if (arg == "--trace")
+        {
+            // also print progress & rebalancing traces
+            verbosity = VERBOSITY_TRACE;
+        }
+        else if (arg == "--silent")
+        {
+            // no output at all
+            verbosity = VERBOSITY_SILENT;
+        }
+        else if (arg == "--file-only")
+        {
+            // results only go to output.txt
+            fileOnly = true;
+        }
+        else
+        {
+            fileName = arg;
+        }
+    }
+    if (!outputOpen("output.txt", verbosity, fileOnly))
+    {
+        cerr << "Could not create output.txt" << endl;
+        return 1;
+    }
+    // no file (or "-") is stdin; stdin & FIFOs can't be mapped, so
+    // they're always streamed
+    if (fileName.empty())
+    {
+        fileName = "-";
+    }
+    struct stat inputInfo;
+    if (fileName == "-" || (stat(fileName.c_str(), &inputInfo) == 0 && !S_ISREG(inputInfo.st_mode)))
+    {
+        streaming = true;
+    }
+    if (!streaming && !parser.open(fileName))
+    {
+        cerr << "Could not open input file " << fileName << endl;
+        return 1;
     }
 
-    // backtrace thru track stack and
-    // check/resolve any imbalances
-    checkImbalance(trackStack);
-}
+    if (compactMode && mvccMode)
+    {
+        cerr << "--compact and --mvcc can't be combined" << endl;
+        return 1;
+    }
+    if (shardCount > 0 && (compactMode || mvccMode))
+    {
+        cerr << "--shards can't be combined with --compact or --mvcc" << endl;
+        return 1;
+    }
+    if (treeOption != NULL && (shardCount > 0 || compactMode || mvccMode))
+    {
+        // the other modes build their own trees & would ignore it
+        cerr << treeOption << " can't be combined with --shards, --compact or --mvcc" << endl;
+        return 1;
+    }
+    if (shardCount > 0)
+    {
+        shardedTree = new ShardedExecutor(shardCount);
+    }
+    if (mvccMode)
+    {
+        mainReader = mvccTree.registerReader();
+    }
+    if (!walPath.empty() && !recover(walSyncOps, walSyncMillis))
+    {
+        return 1;
+    }
+    if (streaming)
+    {
+        if (!stream.open(fileName, followInput, streamBufferBytes))
+        {
+            cerr << "Could not open input stream " << fileName << endl;
+            return 1;
+        }
+        if (followInput)
+        {
+            signal(SIGINT, stopFollowing);
+            signal(SIGTERM, stopFollowing);
+        }
+    }
+    vector<thread> readers;
+    vector<size_t> readerLookups(readerThreads, 0);
+    vector<size_t> readerHits(readerThreads, 0);
+    for (int i = 0; i < readerThreads; i++)
+    {
+        readers.push_back(thread(readerLoop, 2654435761u * (i + 1), &readerLookups[i], &readerHits[i]));
+    }
+    auto startTime = chrono::steady_clock::now();
 
-void Delete(int key)
-{
-    Node *current = AvlTree;
-    Node *parent = NULL;
-    bool foundNode = false;
-    bool isLeftChild;
+    Command command;
 
-    // use to keep track of path taken to Insert new node
-    // Will use track stack to back trace nodes and
-    // check for any imbalances introduced
-    stack<Node *> trackStack;
+    // consecutive Search(k) lines are collected & looked up as one batch;
+    // any other command runs the pending batch first, so output order
+    // is the same as running them one by one
+    int pendingSearches[MAX_COMMAND_ARGS];
+    size_t pendingCount = 0;
 
-    // you know the drill -- find the node to be deleted
-    // (as long as tree is not empty)
-    // and push visited nodes to the track stack
-    // and keep track of if it's a left or right child
-    if (current != NULL)
+    // parse thru input command by command
+    while (true)
     {
-        while (foundNode == false && current != NULL)
+        if (streaming && stream.wouldWait())
         {
-            if (current->data > key)
+            // input ran dry: finish what's pending & hand the results
+            // over before waiting, so a live producer sees them now
+            if (pendingCount > 0)
             {
-                trackStack.push(current);
-                parent = current;
-                current = current->left;
-                isLeftChild = true;
+                SearchBatch(pendingSearches, pendingCount);
+                pendingCount = 0;
             }
-            else if (current->data < key)
+            if (shardedTree != NULL)
             {
-                trackStack.push(current);
-                parent = current;
-                current = current->right;
-                isLeftChild = false;
+                shardedTree->flush();
             }
-            else
+            wal.sync();
+            outputFlush();
+        }
+        if (!(streaming ? stream.next(command) : parser.next(command)))
+        {
+            break;
+        }
+        int *args = command.args;
+
+        if (command.type == CMD_SEARCH && command.argCount == 1)
+        {
+            trace << "Searching " << args[0] << "\n";
+            pendingSearches[pendingCount++] = args[0];
+            if (pendingCount == MAX_COMMAND_ARGS)
             {
-                foundNode = true;
+                SearchBatch(pendingSearches, pendingCount);
+                pendingCount = 0;
             }
+            continue;
+        }
+        if (pendingCount > 0)
+        {
+            SearchBatch(pendingSearches, pendingCount);
+            pendingCount = 0;
         }
-    }
 
-    // once found node to be deleted ...
-    if (current != NULL && current->data == key)
-    {
-        cout << current->data << endl;
+        switch (command.type)
+        {
+        case CMD_INITIALIZE:
+            trace << "Initializing AVL Tree\n";
+            Initialize();
+            break;
 
-        // CASE 1: TRIVIAL DELETE - element is a leaf (0 children)
-        if (current->left == NULL && current->right == NULL)
+        case CMD_BULK_INSERT:
         {
-            cout << "TRIVIAL DELETE" << endl;
-            // de-allocate memory
-            delete current;
-            // change ptr of node to null (removes from tree)
-            current = NULL;
-            if (isLeftChild)
+            // path argument points into the input; copy it out
+            string path(command.text, command.textLength);
+            trace << "Bulk inserting keys from " << path << "\n";
+            BulkInsert(path);
+            // too big to log key by key
+            Checkpoint(true);
+            break;
+        }
+
+        case CMD_INSERT:
+            trace << "Inserting " << args[0] << "\n";
+            Insert(args[0]);
+            break;
+
+        case CMD_DELETE:
+            trace << "Deleting " << args[0] << "\n";
+            Delete(args[0]);
+            break;
+
+        case CMD_UPSERT:
+            trace << "Setting " << args[0] << " to " << args[1] << "\n";
+            if (valuesKept(command))
             {
-                parent->left = NULL;
+                Upsert(args[0], args[1]);
             }
-            else
+            break;
+
+        case CMD_GET_OR_INSERT:
+            trace << "Getting or inserting " << args[0] << " with " << args[1] << "\n";
+            if (valuesKept(command))
             {
-                parent->right = NULL;
+                GetOrInsert(args[0], args[1]);
             }
-        }
-        // CASE 3: element has 2 children
-        else if (current->left != NULL && current->right != NULL)
-        {
-            cout << "HAS 2 CHILDREN" << endl;
-            Node *minInRight = NULL;
+            break;
 
-            // find the min node in right tree
-            // start in the right subtree, and keep goign left
-            minInRight = current->right;
-            while (minInRight->left != NULL)
+        case CMD_INCREMENT:
+            trace << "Incrementing " << args[0] << " by " << args[1] << "\n";
+            if (valuesKept(command))
             {
-                minInRight = minInRight->left;
+                Increment(args[0], args[1]);
             }
+            break;
 
-            cout << "MIN IN RIGHT IS " << minInRight->data << endl;
+        case CMD_SEARCH:
+        {
+            // (specific searches were batched above) range search
+            int limit = command.argCount == 3 ? args[2] : 0;
+            trace << "Searching within range " << args[0] << " and " << args[1];
+            if (limit > 0)
+            {
+                trace << " (limit " << limit << ")";
+            }
+            trace << "\n";
+            Search(args[0], args[1], limit);
+            break;
+        }
 
-            // copy minInRight's data into node to be deleted
-            // and delete original minInRight node
-            current->data = minInRight->data;
-            if (current->right->data != minInRight->data)
+        case CMD_SEARCH_MANY:
+            trace << "Searching " << command.argCount << " keys\n";
+            SearchBatch(args, command.argCount);
+            break;
+
+        case CMD_COUNT:
+            trace << "Counting within range " << args[0] << " and " << args[1] << "\n";
+            Count(args[0], args[1]);
+            break;
+
+        case CMD_RANK:
+            trace << "Ranking " << args[0] << "\n";
+            Rank(args[0]);
+            break;
+
+        case CMD_SELECT:
+            trace << "Selecting " << args[0] << "\n";
+            Select(args[0]);
+            break;
+
+        case CMD_FLOOR:
+            trace << "Floor of " << args[0] << "\n";
+            Floor(args[0]);
+            break;
+
+        case CMD_CEILING:
+            trace << "Ceiling of " << args[0] << "\n";
+            Ceiling(args[0]);
+            break;
+
+        case CMD_PRED:
+            trace << "Predecessor of " << args[0] << "\n";
+            Pred(args[0]);
+            break;
+
+        case CMD_SUCC:
+            trace << "Successor of " << args[0] << "\n";
+            Succ(args[0]);
+            break;
+
+        case CMD_AGGREGATE:
+        {
+            string op(command.text, command.textLength);
+            trace << "Aggregating " << op << " within range " << args[0] << " and " << args[1] << "\n";
+            if (op == "sum")
             {
-                Node *tmp = current->right;
-                while (tmp->left->left != NULL)
-                {
-                    tmp = tmp->left;
-                }
-                cout << "NOT EQUAL" << endl;
-                tmp->left = minInRight->right;
+                Aggregate(AGGREGATE_SUM, args[0], args[1]);
             }
-            else
+            else if (op == "min")
             {
-                cout << "EQUAL" << endl;
-                current->right = minInRight->right;
+                Aggregate(AGGREGATE_MIN, args[0], args[1]);
             }
-            delete minInRight;
-        }
-        // CASE 2: element has 1 child only
-        else
-        {
-            cout << "HAS 1 CHILD" << endl;
-            // has left child; rearrange ptrs to "skip" over itself
-            if (current->left != NULL)
+            else if (op == "max")
+            {
+                Aggregate(AGGREGATE_MAX, args[0], args[1]);
+            }
+            else if (op == "count")
             {
-                // tmp ptr to current node so can delete later
-                Node *tmp = current;
-                // move current ptr to its left child
-                current = current->left;
-
-                if (isLeftChild)
-                {
-                    parent->left = current;
-                }
-                else
-                {
-                    parent->right = current;
-                }
-
-                // delete the tmp ptr (deletes target node)
-                delete tmp;
+                Aggregate(AGGREGATE_COUNT, args[0], args[1]);
             }
-            // has right child; same as previous
             else
             {
-                Node *tmp = current;
-                current = current->right;
-                if (isLeftChild)
-                {
-                    parent->left = current;
-                }
-                else
-                {
-                    parent->right = current;
-                }
-                delete tmp;
+                cerr << "Line " << command.lineNumber << ": unknown aggregate " << op
+                     << " (expected sum, min, max or count). Moving on to next command." << endl;
             }
+            break;
         }
-    }
-
-    // backtrace thru track stack and
-    // check/resolve any imbalances
-    checkImbalance(trackStack);
-}
-
-int main(int argc, char **argv)
-{
-    outputFile.open("output.txt");
-
-    ifstream inputFile;
-    string fileName;
-
-    // get input file name from command line
-    for (int i = 0; i < argc; ++i)
-    {
-        fileName = argv[i];
-    }
-    inputFile.open(fileName);
 
-    string userInput;
-    string command;
-    string argument;
-    int argumentValue;
+        case CMD_ALLOCATOR_STATS:
+            AllocatorStats();
+            break;
 
-    // parse thru input line by line
-    while (inputFile.good())
-    {
-        getline(inputFile, userInput);
+        case CMD_FREEZE:
+            trace << "Freezing AVL Tree\n";
+            Freeze();
+            break;
 
-        // search for functions
+        case CMD_STATS:
+            Stats();
+            break;
 
-        if (userInput.find("Initialize") != string::npos)
+        case CMD_SAVE:
         {
-            cout << "Initializing AVL Tree" << endl;
-            Initialize();
+            string path(command.text, command.textLength);
+            trace << "Saving keys to " << path << "\n";
+            Save(path);
+            break;
         }
 
-        else if (userInput.find("Insert") != string::npos)
+        case CMD_LOAD:
         {
-            // extract argument for insert
-            argument = userInput.substr(7, userInput.length() - 8);
+            string path(command.text, command.textLength);
+            trace << "Loading keys from " << path << "\n";
+            if (Load(path))
+            {
+                Checkpoint(true);
+            }
+            break;
+        }
 
-            // convert to integer using stringstream
-            stringstream ss;
-            ss << argument;
-            ss >> argumentValue;
-            cout << "Inserting " << argumentValue << endl;
+        case CMD_DELETE_RANGE:
+            trace << "Deleting within range " << args[0] << " and " << args[1] << "\n";
+            DeleteRange(args[0], args[1]);
+            break;
 
-            // call function
-            Insert(argumentValue);
-        }
+        case CMD_EXTRACT_RANGE:
+            trace << "Extracting within range " << args[0] << " and " << args[1] << "\n";
+            ExtractRange(args[0], args[1]);
+            break;
 
-        else if (userInput.find("Delete") != string::npos)
+        case CMD_MERGE:
         {
-            // extract argument for delete
-            argument = userInput.substr(7, userInput.length() - 8);
-
-            // convert to integer using stringstream
-            stringstream ss;
-            ss << argument;
-            ss >> argumentValue;
-            cout << "Deleting " << argumentValue << endl;
+            string path(command.text, command.textLength);
+            trace << "Merging keys from " << path << "\n";
+            if (Merge(path))
+            {
+                // not logged key by key
+                Checkpoint(true);
+            }
+            break;
+        }
 
-            // call function
-            Delete(argumentValue);
+        case CMD_CHECKPOINT:
+            trace << "Checkpointing\n";
+            Checkpoint(false);
+            break;
         }
 
-        else if (userInput.find("Search") != string::npos)
+        if (walLogging && wal.recordsSinceCheckpoint() >= checkpointEvery)
         {
-            // extract argument for search
-            argument = userInput.substr(7, userInput.length() - 8);
-
-            // see if a comma exists in argument; distinguishes if
-            // specific search vs range search
-            size_t comma = argument.find(",");
-
-            // if comma exists, is range search
-            if (comma != string::npos)
-            {
-                // extract both arguments for search
-                string firstArg = argument.substr(0, comma);
-                string secondArg = argument.substr(comma + 1, argument.length() - comma);
-
-                // convert to integers using stringstream
-                stringstream ss1, ss2;
-                int firstArgVal, secondArgVal = 0;
-                ss1 << firstArg;
-                ss1 >> firstArgVal;
-                ss2 << secondArg;
-                ss2 >> secondArgVal;
-
-                cout << "Searching within range " << firstArgVal << " and " << secondArgVal << endl;
-                // call function
-                Search(firstArgVal, secondArgVal);
-            }
-            // if no comma, is specific search
-            else
-            {
-                // convert argument to integer using stringstream
-                stringstream ss;
-                ss << argument;
-                ss >> argumentValue;
-                cout << "Searching " << argumentValue << endl;
-
-                // call function
-                Search(argumentValue);
-            }
+            Checkpoint(false);
+        }
+        if (walLogging)
+        {
+            // the group's time limit runs out between mutations too,
+            // e.g. during a long stretch of searches
+            wal.syncIfDue();
+        }
+        if (walLogging && wal.failed())
+        {
+            // changes can't be made durable any more: stop here
+            cerr << "Line " << command.lineNumber << ": write-ahead log failed; not applying any more commands" << endl;
+            break;
         }
+    }
 
-        else
+    if (pendingCount > 0)
+    {
+        SearchBatch(pendingSearches, pendingCount);
+    }
+    if (shardedTree != NULL)
+    {
+        // run whatever is still queued
+        shardedTree->flush();
+        trace << "Shards re-split " << shardedTree->resplitCount() << " time(s)\n";
+        delete shardedTree;
+    }
+
+    if (readerThreads > 0)
+    {
+        stopReaders.store(true);
+        size_t totalLookups = 0;
+        size_t totalHits = 0;
+        for (int i = 0; i < readerThreads; i++)
         {
-            cout << "Invalid command. Moving on to next command." << endl;
+            readers[i].join();
+            totalLookups += readerLookups[i];
+            totalHits += readerHits[i];
         }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+        cerr << readerThreads << " reader(s) ran " << totalLookups << " lookups ("
+             << (size_t)(totalLookups / seconds) << "/s, " << totalHits
+             << " found) alongside the commands" << endl;
+    }
+
+    size_t malformed = parser.errorCount();
+    if (streaming)
+    {
+        stream.close();
+        malformed = stream.errorCount();
+        trace << "Streamed " << stream.bytesRead() << " bytes; the tree waited for input "
+              << stream.treeWaits() << " time(s), the reader waited for the tree "
+              << stream.readerWaits() << " time(s)\n";
+    }
+    if (malformed > 0)
+    {
+        cerr << malformed << " malformed line(s) skipped" << endl;
     }
 
-    // close files
-    outputFile.close();
-    inputFile.close();
+    // last group commit
+    bool walOk = wal.close();
 
-    cout << "Done! Please check output.txt for results." << endl;
+    trace << "Done! Please check output.txt for results.\n";
 
-    return 0;
-}
\ No newline at end of file
+    // flush & close files
+    outputClose();
+    parser.close();
+
+    return walOk ? 0 : 1;
+}
@@ -0,0 +1,2319 @@
+#ifndef AVL_TREE_H
+#define AVL_TREE_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#ifdef AVL_DEBUG
+#include <cassert>
+#endif
+#include "lookup_cache.h"
+#include "slab_pool.h"
+
+// Value type for trees that are just a set of keys
+// (nodes of such trees don't store a value at all)
+struct NoValue
+{
+};
+
+// Compile-time policies decide what a tree does besides its job.
+// tracing:    call onTrace for every rotation & Delete case
+// statistics: count rotations, nodes visited & Delete cases in TreeStats
+// When a flag is false the code for it is compiled out (if constexpr).
+struct QuietPolicy
+{
+    static const bool tracing = false;
+    static const bool statistics = false;
+
+    static void onTrace(const char *) {}
+    template <typename Key>
+    static void onTrace(const char *, const Key &) {}
+};
+
+// operation counters, kept when the policy asks for statistics
+struct TreeStats
+{
+    unsigned long long llRotations;
+    unsigned long long rrRotations;
+    unsigned long long lrRotations;
+    unsigned long long rlRotations;
+
+    // calls & nodes looked at (successful or not)
+    unsigned long long searches;
+    unsigned long long searchVisits;
+    unsigned long long inserts;
+    unsigned long long insertVisits;
+    unsigned long long erases;
+    unsigned long long eraseVisits;
+
+    // which Delete case removed the key
+    unsigned long long leafDeletes;
+    unsigned long long oneChildDeletes;
+    unsigned long long twoChildDeletes;
+
+    // full rebuilds done by relaxed balancing
+    unsigned long long rebuilds;
+
+    // tombstone compactions (lazy deletes) & the time they took, and
+    // the dead nodes freed (by compactions & by range splits)
+    unsigned long long compactions;
+    unsigned long long compactNanos;
+    unsigned long long tombstonesPurged;
+
+    // add another tree's counters (e.g. to report shards as one tree)
+    TreeStats &operator+=(const TreeStats &other)
+    {
+        llRotations += other.llRotations;
+        rrRotations += other.rrRotations;
+        lrRotations += other.lrRotations;
+        rlRotations += other.rlRotations;
+        searches += other.searches;
+        searchVisits += other.searchVisits;
+        inserts += other.inserts;
+        insertVisits += other.insertVisits;
+        erases += other.erases;
+        eraseVisits += other.eraseVisits;
+        leafDeletes += other.leafDeletes;
+        oneChildDeletes += other.oneChildDeletes;
+        twoChildDeletes += other.twoChildDeletes;
+        rebuilds += other.rebuilds;
+        compactions += other.compactions;
+        compactNanos += other.compactNanos;
+        tombstonesPurged += other.tombstonesPurged;
+        return *this;
+    }
+};
+
+// How a tree rebalances after Insert/Delete (see AvlTree::setBalance).
+// Searches give the same results in every mode; only the shape differs.
+enum BalanceMode
+{
+    // strict AVL: heights of siblings differ by at most 1; a Delete can
+    // rotate at every level on the way up
+    BALANCE_AVL,
+    // weak AVL (rank balanced): rank differences of 1 or 2, at most 2
+    // rotations per Delete & O(1) amortized rebalancing per update;
+    // height stays under 2 log2 n (the AVL bound with no deletes)
+    BALANCE_WAVL,
+    // Inserts rebalance like WAVL, Deletes don't rebalance at all; the
+    // whole tree is rebuilt balanced once there have been as many
+    // Deletes as there are keys (O(1) amortized)
+    BALANCE_RELAXED
+};
+
+// Aggregates: every node can keep a summary (a monoid) of its subtree,
+// so aggregateRange answers range queries from two root-to-leaf paths.
+// An Aggregate provides
+//   Type                    the summary
+//   identity()              summary of no keys
+//   lift(key, value)        summary of one key (value is NoValue for sets)
+//   combine(left, right)    summary of left's keys followed by right's;
+//                           must be associative (needn't be commutative)
+// NoAggregate keeps nothing, so nodes don't grow.
+struct NoAggregate
+{
+    typedef NoValue Type;
+};
+
+// sum of the keys, in Sum so it doesn't overflow Key
+template <typename Key, typename Sum = long long>
+struct SumAggregate
+{
+    typedef Sum Type;
+
+    static Type identity() { return Sum(); }
+    template <typename V>
+    static Type lift(const Key &key, const V &) { return Sum(key); }
+    static Type combine(const Type &left, const Type &right) { return left + right; }
+};
+
+template <typename Key>
+struct MinAggregate
+{
+    typedef Key Type;
+
+    static Type identity() { return std::numeric_limits<Key>::max(); }
+    template <typename V>
+    static Type lift(const Key &key, const V &) { return key; }
+    static Type combine(const Type &left, const Type &right) { return right < left ? right : left; }
+};
+
+template <typename Key>
+struct MaxAggregate
+{
+    typedef Key Type;
+
+    static Type identity() { return std::numeric_limits<Key>::lowest(); }
+    template <typename V>
+    static Type lift(const Key &key, const V &) { return key; }
+    static Type combine(const Type &left, const Type &right) { return left < right ? right : left; }
+};
+
+namespace avl_detail
+{
+    // key & value part of a node
+    template <typename Key, typename Value>
+    struct NodeData
+    {
+        Key key;
+        Value value;
+
+        template <typename K, typename V>
+        NodeData(K &&k, V &&v) : key(std::forward<K>(k)), value(std::forward<V>(v)) {}
+    };
+
+    // sets don't pay for an (empty) value
+    template <typename Key>
+    struct NodeData<Key, NoValue>
+    {
+        Key key;
+
+        template <typename K>
+        NodeData(K &&k, NoValue) : key(std::forward<K>(k)) {}
+    };
+
+    // subtree summary part of a node
+    template <typename Aggregate>
+    struct AggregateData
+    {
+        typename Aggregate::Type summary;
+    };
+
+    // no aggregate, no bytes
+    template <>
+    struct AggregateData<NoAggregate>
+    {
+    };
+}
+
+// AVL tree of unique keys, each with an optional value.
+// Key/Value are moved into nodes (never copied), Compare orders keys
+// (a transparent Compare, like std::less<>, allows heterogeneous lookup),
+// Allocator hands out nodes (see SlabPool for the interface), Policy
+// switches tracing & statistics on or off at compile time, and Aggregate
+// picks a subtree summary to keep (see NoAggregate).
+template <typename Key,
+          typename Value = NoValue,
+          typename Compare = std::less<Key>,
+          template <typename> class Allocator = SlabPool,
+          typename Policy = QuietPolicy,
+          typename Aggregate = NoAggregate>
+class AvlTree
+{
+public:
+    // individual node structure: children, cached height (leaf = 1),
+    // tombstone flag & number of live nodes of the subtree rooted here,
+    // then key & value (& the subtree's summary, if there's an Aggregate)
+    struct Node : avl_detail::NodeData<Key, Value>, avl_detail::AggregateData<Aggregate>
+    {
+        Node *left;
+        Node *right;
+        short height; // <= MAX_DEPTH; short leaves room for dead
+        bool dead;    // lazily deleted: still linked, but not a key
+        unsigned int size;
+
+        template <typename K, typename V>
+        Node(K &&k, V &&v) : avl_detail::NodeData<Key, Value>(std::forward<K>(k), std::forward<V>(v))
+        {
+            // new nodes are always leaves
+            left = NULL;
+            right = NULL;
+            height = 1;
+            dead = false;
+            size = 1;
+            if constexpr (hasAggregate)
+            {
+                this->summary = Aggregate::lift(this->key, valueOf(this));
+            }
+        }
+    };
+
+    static constexpr bool hasAggregate = !std::is_same<Aggregate, NoAggregate>::value;
+    static constexpr bool cacheable = std::is_default_constructible<std::hash<Key>>::value;
+
+    // AVL height is < 1.45 log2(n + 2), so this covers any tree that fits in memory
+    static const int MAX_DEPTH = 96;
+
+    AvlTree()
+    {
+        root = NULL;
+        stats = TreeStats();
+        balance = BALANCE_AVL;
+        relaxedDeletes = 0;
+        tombstoneRatio = 0;
+        tombstones = 0;
+    }
+
+    explicit AvlTree(const Compare &comp) : compare(comp)
+    {
+        root = NULL;
+        stats = TreeStats();
+        balance = BALANCE_AVL;
+        relaxedDeletes = 0;
+        tombstoneRatio = 0;
+        tombstones = 0;
+    }
+
+    ~AvlTree()
+    {
+        clear();
+    }
+
+    AvlTree(const AvlTree &) = delete;
+    AvlTree &operator=(const AvlTree &) = delete;
+
+    // Remove every key. O(1) when nodes need no destructor.
+    void clear()
+    {
+        if constexpr (!std::is_trivially_destructible<Node>::value)
+        {
+            destroySubtree(root);
+        }
+        root = NULL;
+        pool.releaseAll();
+        relaxedDeletes = 0;
+        tombstones = 0;
+        cacheClear();
+    }
+
+    // (tombstones aren't keys)
+    bool empty() const { return size() == 0; }
+    size_t size() const { return getSize(root); }
+    // cached height of the root; under WAVL/relaxed balancing this is
+    // the root's rank + 1, which is never below the real height
+    int height() const { return getHeight(root); }
+
+    // Pick the balancing rules for later Inserts/Deletes.
+    // A non-empty tree is rebuilt balanced first (O(n)), since e.g. a
+    // WAVL tree isn't always a valid AVL tree.
+    void setBalance(BalanceMode mode)
+    {
+        if (mode != balance && root != NULL)
+        {
+            relinkBalanced();
+        }
+        balance = mode;
+        relaxedDeletes = 0;
+    }
+
+    BalanceMode balanceMode() const { return balance; }
+
+    Allocator<Node> &allocator() { return pool; }
+    const TreeStats &statistics() const { return stats; }
+
+    // Hot-key cache in front of contains/find/containsBatch: about
+    // entries recent lookups (hits or misses) remember the node they
+    // found, so repeated lookups of hot keys skip the descent. Insert &
+    // Delete invalidate exactly the keys whose node they change; range
+    // & bulk operations empty it. 0 (the default) turns it off.
+    // Needs std::hash<Key>.
+    void enableCache(size_t entries)
+    {
+        static_assert(cacheable, "the lookup cache needs std::hash<Key>");
+        cache.resize(entries);
+    }
+
+    const LookupCache<Key, Node *> &lookupCache() const { return cache; }
+
+    // Lazy deletes: erase only marks the node as a tombstone, O(log n)
+    // with no unlinking or rotation (only the sizes & summaries on the
+    // path change); lookups, scans & order statistics skip tombstones,
+    // and inserting the key again revives its node. Once tombstones are
+    // more than ratio (< 1) of all nodes, compact() purges them in one
+    // O(n) pass. 0 (the default) turns it off (compacting first).
+    void setLazyDelete(double ratio)
+    {
+        tombstoneRatio = ratio > 0 ? ratio : 0;
+        if (tombstoneRatio == 0 && tombstones > 0)
+        {
+            compact();
+        }
+    }
+
+    double lazyDeleteRatio() const { return tombstoneRatio; }
+    size_t tombstoneCount() const { return tombstones; }
+
+    // Free every tombstone & relink the live nodes perfectly balanced.
+    // O(n). Tombstones are scattered, so the whole tree is rebuilt:
+    // rebuilding just the subtrees holding them would leave ancestors
+    // out of AVL balance.
+    void compact()
+    {
+        auto start = std::chrono::steady_clock::now();
+        relinkBalanced();
+        if constexpr (Policy::statistics)
+        {
+            stats.compactions++;
+            stats.compactNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                      std::chrono::steady_clock::now() - start)
+                                      .count();
+        }
+        debugValidate();
+    }
+
+    // INSERT
+
+    // Insert key (with Value(), in a map); returns false if it was
+    // already there
+    template <typename K>
+    bool insert(K &&key)
+    {
+        return insert(std::forward<K>(key), Value());
+    }
+
+    // Insert key with value; returns false (& leaves the tree
+    // untouched) if key was already there
+    template <typename K, typename V>
+    bool insert(K &&key, V &&value)
+    {
+        bool inserted;
+        emplace(std::forward<K>(key), std::forward<V>(value), KeepValue(), inserted);
+        return inserted;
+    }
+
+    // UPSERT
+    // one descent each: an existing key's value is changed in place
+    // (no rebalancing), a new key is inserted & rebalanced as usual.
+    // Like find(), writing through a returned reference isn't seen by
+    // the Aggregate summaries.
+
+    // Set key's value, inserting key if needed; returns true if key is new
+    template <typename K, typename V>
+    bool upsert(K &&key, V &&value)
+    {
+        bool inserted;
+        // value is only moved from once: into a new node, or here
+        emplace(std::forward<K>(key), std::forward<V>(value),
+                [&value](Node *n)
+                { n->value = std::forward<V>(value); },
+                inserted);
+        return inserted;
+    }
+
+    // Value stored for key, inserting key with value first if needed
+    template <typename K, typename V>
+    Value &getOrInsert(K &&key, V &&value)
+    {
+        bool inserted;
+        return emplace(std::forward<K>(key), std::forward<V>(value), KeepValue(), inserted)->value;
+    }
+
+    // Add delta to key's value (a new key starts from Value());
+    // returns the new value
+    template <typename K, typename D>
+    Value &increment(K &&key, const D &delta)
+    {
+        Value start = Value();
+        start += delta;
+        bool inserted;
+        return emplace(std::forward<K>(key), std::move(start),
+                       [&delta](Node *n)
+                       { n->value += delta; },
+                       inserted)
+            ->value;
+    }
+
+    // DELETE
+
+    // Remove key; returns false if it wasn't there
+    bool erase(const Key &key)
+    {
+        Node *current = root;
+        Node *parent = NULL;
+        bool isLeftChild = false;
+
+        // use to keep track of path taken to the deleted node
+        // Will use track stack to back trace nodes and
+        // check for any imbalances introduced
+        Node *trackStack[MAX_DEPTH];
+        int depth = 0;
+
+        // find the node to be deleted, pushing visited nodes
+        while (current != NULL)
+        {
+            if (compare(key, current->key))
+            {
+                trackStack[depth++] = current;
+                parent = current;
+                current = current->left;
+                isLeftChild = true;
+            }
+            else if (compare(current->key, key))
+            {
+                trackStack[depth++] = current;
+                parent = current;
+                current = current->right;
+                isLeftChild = false;
+            }
+            else
+            {
+                break;
+            }
+        }
+
+        if (current == NULL || current->dead)
+        {
+            // not found; nothing changed
+            countVisits(stats.erases, stats.eraseVisits, depth);
+            return false;
+        }
+        cacheInvalidate(current->key);
+        if (tombstoneRatio > 0)
+        {
+            // lazy: leave it linked as a tombstone
+            current->dead = true;
+            tombstones++;
+            updateSize(current);
+            fixSizes(trackStack, depth);
+            countVisits(stats.erases, stats.eraseVisits, depth + 1);
+            if (tombstones > tombstoneRatio * (size() + tombstones))
+            {
+                compact();
+            }
+            debugValidate();
+            return true;
+        }
+        Node *removed = current;
+        int foundDepth = depth + 1;
+        // what takes the unlinked node's place (for WAVL rebalancing)
+        Node *replacement = NULL;
+
+        // CASE 1: TRIVIAL DELETE - element is a leaf (0 children)
+        if (current->left == NULL && current->right == NULL)
+        {
+            traceEvent("TRIVIAL DELETE");
+            countCase(stats.leafDeletes);
+            replaceChild(parent, isLeftChild, NULL);
+        }
+        // CASE 3: element has 2 children
+        else if (current->left != NULL && current->right != NULL)
+        {
+            traceEvent("HAS 2 CHILDREN");
+            countCase(stats.twoChildDeletes);
+
+            // node stays in the tree (only its key & value change),
+            // so it & the path down to the min need rebalancing too
+            trackStack[depth++] = current;
+
+            // find the min node in right tree
+            // start in the right subtree, and keep going left
+            Node *minParent = current;
+            Node *minInRight = current->right;
+            while (minInRight->left != NULL)
+            {
+                trackStack[depth++] = minInRight;
+                minParent = minInRight;
+                minInRight = minInRight->left;
+            }
+            traceEvent("MIN IN RIGHT IS ", minInRight->key);
+
+            // move minInRight's key & value into the node to be deleted
+            // and unlink original minInRight node
+            moveData(current, minInRight);
+            // the successor's key now lives in another node
+            cacheInvalidate(current->key);
+            if (minParent != current)
+            {
+                traceEvent("NOT EQUAL");
+                minParent->left = minInRight->right;
+            }
+            else
+            {
+                traceEvent("EQUAL");
+                current->right = minInRight->right;
+            }
+            removed = minInRight;
+            replacement = minInRight->right;
+        }
+        // CASE 2: element has 1 child only
+        else
+        {
+            traceEvent("HAS 1 CHILD");
+            countCase(stats.oneChildDeletes);
+            // rearrange ptrs to "skip" over itself
+            replacement = current->left != NULL ? current->left : current->right;
+            replaceChild(parent, isLeftChild, replacement);
+        }
+
+        destroyNode(removed);
+        // the min search in case 3 visits more nodes
+        countVisits(stats.erases, stats.eraseVisits, std::max(foundDepth, depth + 1));
+
+        // backtrace thru track stack and
+        // check/resolve any imbalances
+        if (balance == BALANCE_AVL)
+        {
+            rebalance(trackStack, depth);
+        }
+        else if (balance == BALANCE_WAVL)
+        {
+            wavlAfterErase(trackStack, depth, replacement);
+        }
+        else
+        {
+            // relaxed: leave ranks be, rebuild once Deletes add up
+            fixSizes(trackStack, depth);
+            if (++relaxedDeletes > size())
+            {
+                rebuild();
+            }
+        }
+        debugValidate();
+        return true;
+    }
+
+    // SEARCH
+
+    bool contains(const Key &key) const { return findNode(key) != NULL; }
+
+    // heterogeneous lookup, only with a transparent Compare
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    bool contains(const K &key) const { return findNode(key) != NULL; }
+
+    // Returns value stored for key, or NULL
+    Value *find(const Key &key)
+    {
+        Node *n = findNode(key);
+        return n != NULL ? &n->value : NULL;
+    }
+
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    Value *find(const K &key)
+    {
+        Node *n = findNode(key);
+        return n != NULL ? &n->value : NULL;
+    }
+
+    // most lookups containsBatch keeps in flight at once
+    static constexpr size_t BATCH_LANES = 16;
+
+    // Batched lookup: found[i] = contains(keys[i]).
+    // Runs up to BATCH_LANES descents in lockstep, prefetching each
+    // lane's next node, so the cache misses of independent lookups
+    // overlap instead of being waited on one at a time.
+    void containsBatch(const Key *keys, size_t keyCount, bool *found) const
+    {
+        for (size_t base = 0; base < keyCount; base += BATCH_LANES)
+        {
+            size_t lanes = std::min(BATCH_LANES, keyCount - base);
+            size_t visited = 0;
+            Node *current[BATCH_LANES];
+            for (size_t i = 0; i < lanes; i++)
+            {
+                current[i] = root;
+                found[base + i] = false;
+                Node *cached;
+                if (cacheLookup(keys[base + i], cached))
+                {
+                    // answered already; lane sits this batch out
+                    found[base + i] = cached != NULL;
+                    current[i] = NULL;
+                }
+            }
+
+            // one level of every unfinished lookup per round
+            size_t active = lanes;
+            while (active > 0)
+            {
+                active = 0;
+                for (size_t i = 0; i < lanes; i++)
+                {
+                    Node *n = current[i];
+                    if (n == NULL)
+                    {
+                        continue;
+                    }
+                    const Key &key = keys[base + i];
+                    visited++;
+                    if (compare(key, n->key))
+                    {
+                        n = n->left;
+                    }
+                    else if (compare(n->key, key))
+                    {
+                        n = n->right;
+                    }
+                    else
+                    {
+                        found[base + i] = !n->dead;
+                        if (found[base + i])
+                        {
+                            cacheStore(key, n);
+                        }
+                        n = NULL;
+                    }
+                    if (n == NULL && !found[base + i])
+                    {
+                        cacheStore(key, NULL);
+                    }
+
+                    if (n != NULL)
+                    {
+                        __builtin_prefetch(n);
+                        active++;
+                    }
+                    current[i] = n;
+                }
+            }
+            if constexpr (Policy::statistics)
+            {
+                stats.searches += lanes;
+                stats.searchVisits += visited;
+            }
+        }
+    }
+
+    // NEAREST KEYS
+    // each is one O(log n) descent; NULL if there's no such key
+
+    // largest key <= key
+    const Key *floor(const Key &key) const { return keyOf(nearestNode(key, true, true)); }
+    // smallest key >= key
+    const Key *ceiling(const Key &key) const { return keyOf(nearestNode(key, false, true)); }
+    // largest key < key
+    const Key *predecessor(const Key &key) const { return keyOf(nearestNode(key, true, false)); }
+    // smallest key > key
+    const Key *successor(const Key &key) const { return keyOf(nearestNode(key, false, false)); }
+
+    // In-order iterator over the keys (& values).
+    // Nodes have no parent ptrs, so it keeps the path from the root:
+    // ++ & -- are amortized O(1) (O(log n) worst case). Decrementing
+    // end() gives the largest key. Any Insert/Delete invalidates it.
+    class Iterator
+    {
+    public:
+        Iterator() : tree(NULL), depth(0) {}
+
+        const Key &operator*() const { return path[depth - 1]->key; }
+        const Key *operator->() const { return &path[depth - 1]->key; }
+        Value &value() const { return path[depth - 1]->value; }
+
+        bool operator==(const Iterator &other) const
+        {
+            return depth == other.depth && (depth == 0 || path[depth - 1] == other.path[depth - 1]);
+        }
+        bool operator!=(const Iterator &other) const { return !(*this == other); }
+
+        Iterator &operator++()
+        {
+            step(true);
+            return *this;
+        }
+
+        Iterator &operator--()
+        {
+            step(false);
+            return *this;
+        }
+
+    private:
+        friend class AvlTree;
+
+        const AvlTree *tree;
+        Node *path[MAX_DEPTH];
+        int depth;
+
+        Iterator(const AvlTree *t) : tree(t), depth(0) {}
+
+        // move on past tombstones
+        void skipDead(bool forward)
+        {
+            while (depth > 0 && path[depth - 1]->dead)
+            {
+                stepOnce(forward);
+            }
+        }
+
+        void step(bool forward)
+        {
+            stepOnce(forward);
+            skipDead(forward);
+        }
+
+        // go down from n, always taking the left (or right) child
+        void descend(Node *n, bool leftmost)
+        {
+            while (n != NULL)
+            {
+                path[depth++] = n;
+                n = leftmost ? n->left : n->right;
+            }
+        }
+
+        // to the next node, tombstone or not
+        void stepOnce(bool forward)
+        {
+            if (depth == 0)
+            {
+                // end: backing up lands on the largest key
+                if (!forward)
+                {
+                    descend(tree->root, false);
+                }
+                return;
+            }
+
+            // next key is the leftmost node of the right subtree...
+            Node *n = path[depth - 1];
+            Node *child = forward ? n->right : n->left;
+            if (child != NULL)
+            {
+                descend(child, forward);
+            }
+            else
+            {
+                // ...or the first ancestor we reach from its left side
+                Node *from;
+                do
+                {
+                    from = path[--depth];
+                } while (depth > 0 && (forward ? path[depth - 1]->right : path[depth - 1]->left) == from);
+            }
+        }
+    };
+
+    Iterator begin() const
+    {
+        Iterator it(this);
+        it.descend(root, true);
+        it.skipDead(true);
+        return it;
+    }
+
+    Iterator end() const { return Iterator(this); }
+
+    // Iterator at the smallest key >= key (end() if none)
+    Iterator lowerBound(const Key &key) const
+    {
+        Iterator it(this);
+        Node *n = root;
+        // path keeps every node above the target; nodes we stepped
+        // right from are < key & get popped off at the end
+        while (n != NULL)
+        {
+            it.path[it.depth++] = n;
+            n = compare(n->key, key) ? n->right : n->left;
+        }
+        while (it.depth > 0 && compare(it.path[it.depth - 1]->key, key))
+        {
+            it.depth--;
+        }
+        it.skipDead(true);
+        return it;
+    }
+
+    // Cursor for range search
+    // Holds the nodes still to be visited (like an iterative inorder
+    // traversal), so only keys inside [lower, upper] are touched.
+    // start() is O(log n); each next() is amortized O(1).
+    class RangeCursor
+    {
+    public:
+        RangeCursor() : tree(NULL), upper(NULL), depth(0) {}
+
+        // Position cursor at the first key >= lower
+        void start(const AvlTree &t, const Key &lower, const Key &upperBound)
+        {
+            tree = &t;
+            upper = &upperBound;
+            depth = 0;
+
+            // go down toward lower; every node >= lower still has to be
+            // visited (after its left subtree), nodes < lower are skipped
+            Node *n = t.root;
+            while (n != NULL)
+            {
+                if (!t.compare(n->key, lower))
+                {
+                    path[depth++] = n;
+                    n = n->left;
+                }
+                else
+                {
+                    n = n->right;
+                }
+            }
+            skipDead();
+        }
+
+        // Position cursor at the smallest key, with no upper bound
+        void startAtMin(const AvlTree &t)
+        {
+            tree = &t;
+            upper = NULL;
+            depth = 0;
+
+            Node *n = t.root;
+            while (n != NULL)
+            {
+                path[depth++] = n;
+                n = n->left;
+            }
+            skipDead();
+        }
+
+        // Next key in range without moving the cursor,
+        // or NULL once the cursor has passed the upper bound
+        const Key *peek() const
+        {
+            if (depth == 0 || (upper != NULL && tree->compare(*upper, path[depth - 1]->key)))
+            {
+                return NULL;
+            }
+            return &path[depth - 1]->key;
+        }
+
+        // Next key in range & advance, or NULL when done
+        const Key *next()
+        {
+            const Key *key = peek();
+            if (key == NULL)
+            {
+                return NULL;
+            }
+            advance();
+            skipDead();
+            return key;
+        }
+
+    private:
+        const AvlTree *tree;
+        const Key *upper; // caller keeps the bound alive while scanning
+        Node *path[MAX_DEPTH];
+        int depth;
+
+        void advance()
+        {
+            // next node is the leftmost node of the right subtree
+            Node *n = path[--depth]->right;
+            while (n != NULL)
+            {
+                path[depth++] = n;
+                n = n->left;
+            }
+        }
+
+        // move on past tombstones (but not past the upper bound)
+        void skipDead()
+        {
+            while (depth > 0 && path[depth - 1]->dead &&
+                   (upper == NULL || !tree->compare(*upper, path[depth - 1]->key)))
+            {
+                advance();
+            }
+        }
+    };
+
+    // ORDER STATISTICS
+    // all use the cached subtree sizes (live nodes only), so each is a
+    // single O(log n) descent
+
+    // Number of keys < key (or <= key if inclusive)
+    size_t countBelow(const Key &key, bool inclusive) const
+    {
+        Node *current = root;
+        size_t count = 0;
+
+        while (current != NULL)
+        {
+            if (compare(current->key, key) || (inclusive && !compare(key, current->key)))
+            {
+                // current & its whole left subtree are below key
+                count += getSize(current->left) + liveCount(current);
+                current = current->right;
+            }
+            else
+            {
+                current = current->left;
+            }
+        }
+        return count;
+    }
+
+    // Number of keys in [a, b]
+    size_t countRange(const Key &a, const Key &b) const
+    {
+        if (compare(b, a))
+        {
+            return 0;
+        }
+        return countBelow(b, true) - countBelow(a, false);
+    }
+
+    // Number of keys <= key
+    size_t rank(const Key &key) const
+    {
+        return countBelow(key, true);
+    }
+
+    // k-th smallest key (k = 1 is the minimum), or NULL if there isn't one
+    const Key *select(size_t k) const
+    {
+        return keyOf(selectNode(k));
+    }
+
+    // AGGREGATES
+
+    // Summary of the keys in [a, b], in key order (needs an Aggregate).
+    // Goes down to the first node inside the range, then down both of
+    // its sides toward a & b, taking whole subtrees that are inside the
+    // range from their cached summaries: O(log n).
+    // Summaries are lifted when a key is inserted, so a value changed
+    // through find() isn't reflected; re-insert it instead.
+    template <typename A = Aggregate, typename = typename std::enable_if<!std::is_same<A, NoAggregate>::value>::type>
+    typename A::Type aggregateRange(const Key &a, const Key &b) const
+    {
+        typename A::Type result = A::identity();
+        if (compare(b, a))
+        {
+            return result;
+        }
+
+        // topmost node in [a, b]; everything in range is below it
+        Node *split = root;
+        while (split != NULL)
+        {
+            if (compare(split->key, a))
+            {
+                split = split->right;
+            }
+            else if (compare(b, split->key))
+            {
+                split = split->left;
+            }
+            else
+            {
+                break;
+            }
+        }
+        if (split == NULL)
+        {
+            return result;
+        }
+
+        // left side: nodes >= a & their right subtrees, collected
+        // right to left (each one comes before what's already taken)
+        for (Node *n = split->left; n != NULL;)
+        {
+            if (compare(n->key, a))
+            {
+                n = n->right;
+            }
+            else
+            {
+                result = A::combine(A::combine(liftLive(n), summaryOf(n->right)), result);
+                n = n->left;
+            }
+        }
+        result = A::combine(result, liftLive(split));
+
+        // right side: nodes <= b & their left subtrees, left to right
+        for (Node *n = split->right; n != NULL;)
+        {
+            if (compare(b, n->key))
+            {
+                n = n->left;
+            }
+            else
+            {
+                result = A::combine(result, A::combine(summaryOf(n->left), liftLive(n)));
+                n = n->right;
+            }
+        }
+        return result;
+    }
+
+    // RANGE DELETE & MERGE
+    // built on split & join (see below), so the tree is cut & glued
+    // back along O(log n) paths instead of deleting key by key
+
+    // Remove every key in [a, b]; returns how many were removed.
+    // O(log n) to cut the range out, plus O(k) to free its nodes.
+    size_t eraseRange(const Key &a, const Key &b)
+    {
+        return extractRange(a, b, [](Key &&, Value &&) {});
+    }
+
+    // Like eraseRange, but hands each removed key & value (in order)
+    // to visit(Key &&, Value &&) before its node is freed
+    template <typename Visit>
+    size_t extractRange(const Key &a, const Key &b, Visit visit)
+    {
+        if (compare(b, a))
+        {
+            return 0;
+        }
+        Node *below;
+        Node *inRange;
+        Node *above;
+        // tombstones on the split paths & in the range are freed on the
+        // way; the rest stay where they are
+        cacheClear();
+        splitAround(root, a, b, below, inRange, above);
+        root = joinTrees(below, above);
+
+        size_t removed = getSize(inRange);
+        visitAndDestroy(inRange, visit);
+        if (balance == BALANCE_RELAXED)
+        {
+            // counts toward the next rebuild like single Deletes
+            relaxedDeletes += removed;
+            if (relaxedDeletes > size())
+            {
+                rebuild();
+            }
+        }
+        debugValidate();
+        return removed;
+    }
+
+    // Add count sorted, unique keys (e.g. a Save file) by building them
+    // into a balanced tree & taking the union with this one: split this
+    // tree around each of its roots & join the halves back.
+    // O(m log(n / m + 1)) for m keys into n, so small batches stay cheap
+    // (bulkInsert relinks all n + m nodes). Existing keys keep their
+    // values; new ones get values[i] (if given) or Value().
+    void mergeSorted(const Key *keys, size_t count, const Value *values = NULL)
+    {
+        cacheClear();
+        root = unite(root, buildSorted(keys, values, 0, count));
+        debugValidate();
+    }
+
+    // BULK LOAD
+
+    // Insert a batch of keys at once: sort & dedup them, merge with the
+    // nodes already in the tree, and relink everything into a perfectly
+    // balanced tree. O(n) plus the sort; no per-key descent or rotation.
+    // Existing nodes (and their values) are kept; new keys get Value().
+    void bulkInsert(std::vector<Key> keys)
+    {
+        std::sort(keys.begin(), keys.end(), compare);
+        keys.erase(std::unique(keys.begin(), keys.end(), EquivalentKeys(compare)), keys.end());
+
+        // every live node, in order
+        std::vector<Node *> nodes;
+        nodes.reserve(size() + tombstones + keys.size());
+        collectNodes(root, nodes);
+        dropTombstones(nodes);
+        size_t oldCount = nodes.size();
+
+        // merge new keys into the in-order node list
+        std::vector<Node *> merged;
+        merged.reserve(oldCount + keys.size());
+        size_t i = 0;
+        size_t j = 0;
+        while (i < oldCount || j < keys.size())
+        {
+            if (j == keys.size() || (i < oldCount && compare(nodes[i]->key, keys[j])))
+            {
+                merged.push_back(nodes[i++]);
+            }
+            else if (i == oldCount || compare(keys[j], nodes[i]->key))
+            {
+                merged.push_back(createNode(std::move(keys[j++]), Value()));
+            }
+            else
+            {
+                // already in the tree
+                merged.push_back(nodes[i++]);
+                j++;
+            }
+        }
+
+        root = buildBalanced(merged, 0, merged.size());
+        cacheClear();
+        debugValidate();
+    }
+
+    // Replace the contents with count keys that are already sorted &
+    // unique (e.g. a Save file): one pass, nodes allocated in key order.
+    // values, if given, holds the value of each key.
+    void assignSorted(const Key *keys, size_t count, const Value *values = NULL)
+    {
+        clear();
+        root = buildSorted(keys, values, 0, count);
+        debugValidate();
+    }
+
+#ifdef AVL_DEBUG
+    // Debug-only checker: recomputes every height & size from scratch
+    // and asserts they match the cached ones, that the tree is balanced,
+    // that keys are in order & that the lookup cache is up to date
+    void validate() const
+    {
+        size_t dead = 0;
+        validateSubtree(root, NULL, NULL, dead);
+        assert(dead == tombstones);
+        if constexpr (cacheable)
+        {
+            // every cached answer must match a fresh descent
+            cache.forEach([this](const Key &key, Node *n)
+                          {
+                              Node *current = root;
+                              while (current != NULL && !EquivalentKeys(compare)(key, current->key))
+                              {
+                                  current = compare(key, current->key) ? current->left : current->right;
+                              }
+                              assert(n == (current != NULL && current->dead ? NULL : current));
+                          });
+        }
+    }
+#endif
+
+private:
+    Node *root;
+    Compare compare;
+    Allocator<Node> pool;
+    // mutable so const lookups can count too
+    mutable TreeStats stats;
+    // lookups change only its entries & counters, so const ones may too
+    mutable LookupCache<Key, Node *> cache;
+    BalanceMode balance;
+    // Deletes since the last rebuild (relaxed balancing)
+    size_t relaxedDeletes;
+    // lazy deletes: compact once tombstones / nodes > tombstoneRatio
+    // (0 = erase unlinks right away)
+    double tombstoneRatio;
+    size_t tombstones;
+
+    struct EquivalentKeys
+    {
+        const Compare &compare;
+        explicit EquivalentKeys(const Compare &c) : compare(c) {}
+        bool operator()(const Key &a, const Key &b) const
+        {
+            return !compare(a, b) && !compare(b, a);
+        }
+    };
+
+    void traceEvent(const char *event)
+    {
+        if constexpr (Policy::tracing)
+        {
+            Policy::onTrace(event);
+        }
+    }
+
+    void traceEvent(const char *event, const Key &key)
+    {
+        if constexpr (Policy::tracing)
+        {
+            Policy::onTrace(event, key);
+        }
+    }
+
+    // one more op that looked at visited nodes
+    void countVisits(unsigned long long &ops, unsigned long long &visits, size_t visited) const
+    {
+        if constexpr (Policy::statistics)
+        {
+            ops++;
+            visits += visited;
+        }
+    }
+
+    void countCase(unsigned long long &counter)
+    {
+        if constexpr (Policy::statistics)
+        {
+            counter++;
+        }
+    }
+
+    void debugValidate() const
+    {
+#ifdef AVL_DEBUG
+        validate();
+#endif
+    }
+
+    // helper function for creating new node during Insert
+    template <typename K, typename V>
+    Node *createNode(K &&key, V &&value)
+    {
+        return new (pool.allocate()) Node(std::forward<K>(key), std::forward<V>(value));
+    }
+
+    void destroyNode(Node *n)
+    {
+        n->~Node();
+        pool.free(n);
+    }
+
+    void destroySubtree(Node *n)
+    {
+        if (n == NULL)
+            return;
+        destroySubtree(n->left);
+        destroySubtree(n->right);
+        n->~Node();
+    }
+
+    static void moveData(Node *to, Node *from)
+    {
+        to->key = std::move(from->key);
+        if constexpr (!std::is_same<Value, NoValue>::value)
+        {
+            to->value = std::move(from->value);
+        }
+    }
+
+    // Returns cached height of a specific node (empty tree is 0)
+    static int getHeight(const Node *n)
+    {
+        return n == NULL ? 0 : n->height;
+    }
+
+    // Returns summary of subtree (empty tree is the identity)
+    static typename Aggregate::Type summaryOf(const Node *n)
+    {
+        return n == NULL ? Aggregate::identity() : n->summary;
+    }
+
+    // value a node's summary is lifted from (NoValue for sets)
+    static const Value &valueOf(const Node *n)
+    {
+        if constexpr (std::is_same<Value, NoValue>::value)
+        {
+            static const NoValue none = NoValue();
+            return none;
+        }
+        else
+        {
+            return n->value;
+        }
+    }
+
+    // Returns number of live nodes in subtree (empty tree is 0)
+    static size_t getSize(const Node *n)
+    {
+        return n == NULL ? 0 : n->size;
+    }
+
+    // 1 for a key, 0 for a tombstone
+    static unsigned int liveCount(const Node *n)
+    {
+        return n->dead ? 0 : 1;
+    }
+
+    // summary of n's own key (the identity for a tombstone)
+    static typename Aggregate::Type liftLive(const Node *n)
+    {
+        return n->dead ? Aggregate::identity() : Aggregate::lift(n->key, valueOf(n));
+    }
+
+    template <typename V>
+    static void revive(Node *n, V &&value)
+    {
+        n->dead = false;
+        if constexpr (!std::is_same<Value, NoValue>::value)
+        {
+            n->value = std::forward<V>(value);
+        }
+    }
+
+    // Recompute a node's cached height & size from its children's
+    static void updateNode(Node *n)
+    {
+        n->height = std::max(getHeight(n->left), getHeight(n->right)) + 1;
+        updateSize(n);
+    }
+
+    // Recompute a node's size (& summary) only
+    static void updateSize(Node *n)
+    {
+        n->size = getSize(n->left) + getSize(n->right) + liveCount(n);
+        if constexpr (hasAggregate)
+        {
+            n->summary = Aggregate::combine(Aggregate::combine(summaryOf(n->left), liftLive(n)), summaryOf(n->right));
+        }
+    }
+
+    // Left subtree height minus right subtree height
+    static int getBalanceFactor(const Node *n)
+    {
+        return getHeight(n->left) - getHeight(n->right);
+    }
+
+    // Point parent (or root, if no parent) at child
+    void replaceChild(Node *parent, bool isLeftChild, Node *child)
+    {
+        if (parent == NULL)
+        {
+            root = child;
+        }
+        else if (isLeftChild)
+        {
+            parent->left = child;
+        }
+        else
+        {
+            parent->right = child;
+        }
+    }
+
+    template <typename K>
+    Node *findNode(const K &key) const
+    {
+        Node *current;
+        if constexpr (std::is_same<K, Key>::value)
+        {
+            if (cacheLookup(key, current))
+            {
+                countVisits(stats.searches, stats.searchVisits, 0);
+                return current;
+            }
+        }
+
+        current = root;
+        size_t visited = 0;
+        while (current != NULL)
+        {
+            visited++;
+            if (compare(key, current->key))
+            {
+                current = current->left;
+            }
+            else if (compare(current->key, key))
+            {
+                current = current->right;
+            }
+            else
+            {
+                break;
+            }
+        }
+        countVisits(stats.searches, stats.searchVisits, visited);
+        if (current != NULL && current->dead)
+        {
+            current = NULL;
+        }
+        if constexpr (std::is_same<K, Key>::value)
+        {
+            cacheStore(key, current);
+        }
+        return current;
+    }
+
+    // CACHE HELPERS
+    // no-ops while the cache is off (or Key can't be hashed)
+
+    bool cacheLookup(const Key &key, Node *&n) const
+    {
+        if constexpr (cacheable)
+        {
+            if (cache.enabled())
+            {
+                return cache.lookup(key, n, EquivalentKeys(compare));
+            }
+        }
+        return false;
+    }
+
+    void cacheStore(const Key &key, Node *n) const
+    {
+        if constexpr (cacheable)
+        {
+            if (cache.enabled())
+            {
+                cache.store(key, n);
+            }
+        }
+    }
+
+    void cacheInvalidate(const Key &key)
+    {
+        if constexpr (cacheable)
+        {
+            if (cache.enabled())
+            {
+                cache.invalidate(key, EquivalentKeys(compare));
+            }
+        }
+    }
+
+    void cacheClear()
+    {
+        if (cache.enabled())
+        {
+            cache.clear();
+        }
+    }
+
+    // Same descent as findNode, remembering the last node passed on the
+    // wanted side: the closest key below (or above) key, or key itself
+    // if inclusive
+    Node *nearestNode(const Key &key, bool below, bool inclusive) const
+    {
+        if (tombstones > 0)
+        {
+            // the nearest node may be a tombstone; count live keys instead
+            size_t count = countBelow(key, below ? inclusive : !inclusive);
+            return below ? selectNode(count) : selectNode(count + 1);
+        }
+        Node *current = root;
+        Node *best = NULL;
+        size_t visited = 0;
+        while (current != NULL)
+        {
+            visited++;
+            if (compare(key, current->key))
+            {
+                if (!below)
+                {
+                    best = current;
+                }
+                current = current->left;
+            }
+            else if (compare(current->key, key))
+            {
+                if (below)
+                {
+                    best = current;
+                }
+                current = current->right;
+            }
+            else if (inclusive)
+            {
+                best = current;
+                break;
+            }
+            else
+            {
+                // neighbour is the max (or min) of the subtree on that side
+                current = below ? current->left : current->right;
+            }
+        }
+        countVisits(stats.searches, stats.searchVisits, visited);
+        return best;
+    }
+
+    static const Key *keyOf(const Node *n)
+    {
+        return n != NULL ? &n->key : NULL;
+    }
+
+    // node of the k-th smallest key (k = 1 is the minimum), or NULL
+    Node *selectNode(size_t k) const
+    {
+        if (k < 1 || k > size())
+        {
+            return NULL;
+        }
+
+        Node *current = root;
+        while (true)
+        {
+            size_t leftSize = getSize(current->left);
+            if (k <= leftSize)
+            {
+                current = current->left;
+            }
+            else if (k == leftSize + 1 && !current->dead)
+            {
+                return current;
+            }
+            else
+            {
+                // skip left subtree & current node
+                k -= leftSize + liveCount(current);
+                current = current->right;
+            }
+        }
+    }
+
+    // update for keys already in the tree that leaves them alone
+    struct KeepValue
+    {
+        void operator()(Node *) const {}
+    };
+
+    // Insert key with value, or, if key is already there, hand its node
+    // to update instead (value is left untouched then). Returns key's
+    // node; inserted says which happened.
+    template <typename K, typename V, typename Update>
+    Node *emplace(K &&key, V &&value, Update update, bool &inserted)
+    {
+        Node *current = root;
+        Node *parent = NULL;
+        bool isLeftChild = false;
+
+        // use to keep track of path taken to Insert new node
+        // Will use track stack to back trace nodes and
+        // check for any imbalances introduced
+        Node *trackStack[MAX_DEPTH];
+        int depth = 0;
+
+        // find where to insert, pushing visited nodes
+        while (current != NULL)
+        {
+            if (compare(key, current->key))
+            {
+                trackStack[depth++] = current;
+                parent = current;
+                current = current->left;
+                isLeftChild = true;
+            }
+            else if (compare(current->key, key))
+            {
+                trackStack[depth++] = current;
+                parent = current;
+                current = current->right;
+                isLeftChild = false;
+            }
+            else
+            {
+                // no duplicates allowed; update in place
+                countVisits(stats.inserts, stats.insertVisits, depth + 1);
+                if (current->dead)
+                {
+                    // a tombstone: bring it back with the new value
+                    revive(current, std::forward<V>(value));
+                    tombstones--;
+                    cacheInvalidate(current->key);
+                    updateSize(current);
+                    fixSizes(trackStack, depth);
+                    inserted = true;
+                    debugValidate();
+                    return current;
+                }
+                inserted = false;
+                update(current);
+                if constexpr (hasAggregate && !std::is_same<Update, KeepValue>::value)
+                {
+                    // shape is the same, but summaries may lift the value
+                    updateSize(current);
+                    fixSizes(trackStack, depth);
+                }
+                return current;
+            }
+        }
+        countVisits(stats.inserts, stats.insertVisits, depth);
+
+        // new leaf is balanced by definition, so it
+        // doesn't need to go on the track stack
+        Node *leaf = createNode(std::forward<K>(key), std::forward<V>(value));
+        replaceChild(parent, isLeftChild, leaf);
+        // key may be cached as missing
+        cacheInvalidate(leaf->key);
+
+        // backtrace thru track stack and
+        // check/resolve any imbalances
+        if (balance == BALANCE_AVL)
+        {
+            rebalance(trackStack, depth);
+        }
+        else
+        {
+            wavlAfterInsert(trackStack, depth, leaf);
+        }
+        debugValidate();
+        inserted = true;
+        return leaf;
+    }
+
+    // ROTATIONS
+    // each returns the new root of the rotated subtree;
+    // the caller links it to the parent
+
+    // for RR imbalance; moves right child up (left rotation)
+    Node *rrImbalance(Node *n)
+    {
+        traceEvent("RR IMBALANCE ON ", n->key);
+        if constexpr (Policy::statistics)
+        {
+            stats.rrRotations++;
+        }
+        Node *rightChild = n->right;
+        n->right = rightChild->left;
+        rightChild->left = n;
+
+        // n is now below right child, so update it first
+        updateNode(n);
+        updateNode(rightChild);
+        return rightChild;
+    }
+
+    // for LL imbalance; move left child up; right rotation
+    Node *llImbalance(Node *n)
+    {
+        traceEvent("LL IMBALANCE ON ", n->key);
+        if constexpr (Policy::statistics)
+        {
+            stats.llRotations++;
+        }
+        Node *leftChild = n->left;
+        n->left = leftChild->right;
+        leftChild->right = n;
+
+        // n is now below left child, so update it first
+        updateNode(n);
+        updateNode(leftChild);
+        return leftChild;
+    }
+
+    // for LR imbalance; left rotation on child, then right rotation on n
+    Node *lrImbalance(Node *n)
+    {
+        traceEvent("LR IMBALANCE ON ", n->key);
+        if constexpr (Policy::statistics)
+        {
+            stats.lrRotations++;
+        }
+        Node *child = n->left;
+        Node *grandchild = child->right;
+
+        // bring grandchild up, making n & its child children of grandchild
+        child->right = grandchild->left;
+        grandchild->left = child;
+        n->left = grandchild->right;
+        grandchild->right = n;
+
+        updateNode(child);
+        updateNode(n);
+        updateNode(grandchild);
+        return grandchild;
+    }
+
+    // for RL imbalance; right rotation on child, then left rotation on n
+    Node *rlImbalance(Node *n)
+    {
+        traceEvent("RL IMBALANCE ON ", n->key);
+        if constexpr (Policy::statistics)
+        {
+            stats.rlRotations++;
+        }
+        Node *child = n->right;
+        Node *grandchild = child->left;
+
+        // bring grandchild up, making n & its child children of grandchild
+        child->left = grandchild->right;
+        grandchild->right = child;
+        n->right = grandchild->left;
+        grandchild->left = n;
+
+        updateNode(child);
+        updateNode(n);
+        updateNode(grandchild);
+        return grandchild;
+    }
+
+    // Rebalancing function.
+    // Walks back up the track stack updating cached heights & sizes and
+    // directing rotations as necessary. Once a subtree's height is the
+    // same as before the Insert/Delete, nothing above it can become
+    // unbalanced, so the rest of the walk only fixes sizes.
+    void rebalance(Node **trackStack, int depth)
+    {
+        bool heightSettled = false;
+
+        while (depth > 0)
+        {
+            Node *current = trackStack[--depth];
+
+            if (heightSettled)
+            {
+                updateNode(current);
+                continue;
+            }
+
+            int oldHeight = current->height;
+            updateNode(current);
+            int balanceFactor = getBalanceFactor(current);
+            Node *subtreeRoot = current;
+
+            // child balance of 0 can only happen after a Delete,
+            // and is handled by a single rotation
+            if (balanceFactor == 2)
+            {
+                if (getBalanceFactor(current->left) >= 0)
+                {
+                    subtreeRoot = llImbalance(current);
+                }
+                else
+                {
+                    subtreeRoot = lrImbalance(current);
+                }
+            }
+            else if (balanceFactor == -2)
+            {
+                if (getBalanceFactor(current->right) <= 0)
+                {
+                    subtreeRoot = rrImbalance(current);
+                }
+                else
+                {
+                    subtreeRoot = rlImbalance(current);
+                }
+            }
+
+            if (subtreeRoot != current)
+            {
+                // hook rotated subtree back in where current was
+                Node *parent = depth > 0 ? trackStack[depth - 1] : NULL;
+                replaceChild(parent, parent != NULL && parent->left == current, subtreeRoot);
+            }
+
+            // height of this subtree didn't change; ancestors stay balanced
+            if (subtreeRoot->height == oldHeight)
+            {
+                heightSettled = true;
+            }
+        }
+    }
+
+    // WAVL & RELAXED BALANCING
+    // height holds rank + 1 (so NULL is rank -1 & a leaf rank 0); a
+    // child's rank difference is its parent's rank minus its own
+
+    static int rankDiff(const Node *parent, const Node *child)
+    {
+        return parent->height - getHeight(child);
+    }
+
+    // Recompute sizes (& summaries) along the track stack, deepest first
+    static void fixSizes(Node **trackStack, int depth)
+    {
+        while (depth > 0)
+        {
+            updateSize(trackStack[--depth]);
+        }
+    }
+
+    // plain rotations: relink & fix sizes, ranks are up to the caller
+    Node *rotateLeft(Node *n)
+    {
+        Node *rightChild = n->right;
+        n->right = rightChild->left;
+        rightChild->left = n;
+        updateSize(n);
+        updateSize(rightChild);
+        return rightChild;
+    }
+
+    Node *rotateRight(Node *n)
+    {
+        Node *leftChild = n->left;
+        n->left = leftChild->right;
+        leftChild->right = n;
+        updateSize(n);
+        updateSize(leftChild);
+        return leftChild;
+    }
+
+    // Rotate child x up over its parent z (single rotation), or x's
+    // child on the inner side up over both (double); returns the new
+    // subtree root & counts it like the AVL cases
+    Node *rotateUp(Node *z, Node *x, bool twice)
+    {
+        bool xIsLeft = z->left == x;
+        if (!twice)
+        {
+            traceEvent(xIsLeft ? "LL IMBALANCE ON " : "RR IMBALANCE ON ", z->key);
+            if constexpr (Policy::statistics)
+            {
+                (xIsLeft ? stats.llRotations : stats.rrRotations)++;
+            }
+            return xIsLeft ? rotateRight(z) : rotateLeft(z);
+        }
+
+        traceEvent(xIsLeft ? "LR IMBALANCE ON " : "RL IMBALANCE ON ", z->key);
+        if constexpr (Policy::statistics)
+        {
+            (xIsLeft ? stats.lrRotations : stats.rlRotations)++;
+        }
+        if (xIsLeft)
+        {
+            z->left = rotateLeft(x);
+            return rotateRight(z);
+        }
+        z->right = rotateRight(x);
+        return rotateLeft(z);
+    }
+
+    // hook a rotated subtree back in where old was (parent is at level i - 1)
+    void relink(Node **trackStack, int i, Node *old, Node *subtreeRoot)
+    {
+        Node *parent = i > 0 ? trackStack[i - 1] : NULL;
+        replaceChild(parent, parent != NULL && parent->left == old, subtreeRoot);
+    }
+
+    // After linking in leaf below trackStack[depth - 1]: promote while
+    // the new rank is a 0-child with a 1-child sibling, then rotate at
+    // most twice. Same rules in relaxed mode (ranks just sit higher).
+    void wavlAfterInsert(Node **trackStack, int depth, Node *leaf)
+    {
+        fixSizes(trackStack, depth);
+
+        Node *x = leaf;
+        int i = depth;
+        while (i > 0)
+        {
+            Node *z = trackStack[i - 1];
+            if (rankDiff(z, x) != 0)
+            {
+                break;
+            }
+            Node *sibling = z->left == x ? z->right : z->left;
+            if (rankDiff(z, sibling) == 1)
+            {
+                // promote & go up
+                z->height++;
+                x = z;
+                i--;
+                continue;
+            }
+
+            // sibling is 2-child (or more, relaxed): x was just promoted
+            // so one child is a 1-child, the other a 2-child
+            Node *inner = z->left == x ? x->right : x->left;
+            Node *subtreeRoot;
+            if (rankDiff(x, inner) >= 2)
+            {
+                subtreeRoot = rotateUp(z, x, false);
+                z->height--;
+            }
+            else
+            {
+                subtreeRoot = rotateUp(z, x, true);
+                inner->height++;
+                x->height--;
+                z->height--;
+            }
+            relink(trackStack, i - 1, z, subtreeRoot);
+            break;
+        }
+    }
+
+    // After unlinking a node, replacement (maybe NULL) is the child of
+    // trackStack[depth - 1] that took its place: demote while there's a
+    // 3-child, then rotate at most twice
+    void wavlAfterErase(Node **trackStack, int depth, Node *replacement)
+    {
+        fixSizes(trackStack, depth);
+
+        Node *x = replacement;
+        int i = depth;
+        if (i > 0)
+        {
+            // a rank 1 node left without children becomes a rank 0 leaf
+            Node *p = trackStack[i - 1];
+            if (p->left == NULL && p->right == NULL && p->height == 2)
+            {
+                p->height = 1;
+                x = p;
+                i--;
+            }
+        }
+
+        while (i > 0)
+        {
+            Node *z = trackStack[i - 1];
+            if (rankDiff(z, x) != 3)
+            {
+                break;
+            }
+            bool xIsLeft = z->left == x;
+            Node *y = xIsLeft ? z->right : z->left;
+            if (rankDiff(z, y) == 2)
+            {
+                z->height--;
+                x = z;
+                i--;
+                continue;
+            }
+            if (rankDiff(y, y->left) == 2 && rankDiff(y, y->right) == 2)
+            {
+                // y is 2,2: demote both
+                z->height--;
+                y->height--;
+                x = z;
+                i--;
+                continue;
+            }
+
+            // rotate y (or its inner child) up; ends the walk
+            Node *outer = xIsLeft ? y->right : y->left;
+            Node *inner = xIsLeft ? y->left : y->right;
+            Node *subtreeRoot;
+            if (rankDiff(y, outer) == 1)
+            {
+                subtreeRoot = rotateUp(z, y, false);
+                y->height++;
+                z->height--;
+                if (z->left == NULL && z->right == NULL)
+                {
+                    z->height--;
+                }
+            }
+            else
+            {
+                subtreeRoot = rotateUp(z, y, true);
+                inner->height += 2;
+                y->height--;
+                z->height -= 2;
+            }
+            relink(trackStack, i - 1, z, subtreeRoot);
+            break;
+        }
+    }
+
+    // Relink every node into a perfectly balanced tree (ranks become
+    // real heights, which suits every mode), freeing tombstones. O(n).
+    // Not counted anywhere; see rebuild & compact.
+    void relinkBalanced()
+    {
+        std::vector<Node *> nodes;
+        nodes.reserve(size() + tombstones);
+        collectNodes(root, nodes);
+        dropTombstones(nodes);
+        root = buildBalanced(nodes, 0, nodes.size());
+        relaxedDeletes = 0;
+    }
+
+    // relaxed balancing's periodic relink
+    void rebuild()
+    {
+        relinkBalanced();
+        if constexpr (Policy::statistics)
+        {
+            stats.rebuilds++;
+        }
+    }
+
+    // Free the tombstones in an in-order node list & close the gaps
+    void dropTombstones(std::vector<Node *> &nodes)
+    {
+        if (tombstones == 0)
+        {
+            return;
+        }
+        size_t live = 0;
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            if (nodes[i]->dead)
+            {
+                purgeNode(nodes[i]);
+            }
+            else
+            {
+                nodes[live++] = nodes[i];
+            }
+        }
+        nodes.resize(live);
+    }
+
+    // Free a tombstone that has been unlinked
+    void purgeNode(Node *n)
+    {
+        destroyNode(n);
+        tombstones--;
+        if constexpr (Policy::statistics)
+        {
+            stats.tombstonesPurged++;
+        }
+    }
+
+    // SPLIT & JOIN
+
+    // Rebalance a single node whose children differ in height by at most 2
+    Node *balanceNode(Node *n)
+    {
+        updateNode(n);
+        int balanceFactor = getBalanceFactor(n);
+        if (balanceFactor == 2)
+        {
+            return getBalanceFactor(n->left) >= 0 ? llImbalance(n) : lrImbalance(n);
+        }
+        if (balanceFactor == -2)
+        {
+            return getBalanceFactor(n->right) <= 0 ? rrImbalance(n) : rlImbalance(n);
+        }
+        return n;
+    }
+
+    // Join left, mid & right into one tree, where every key in left is
+    // < mid's key < every key in right. Goes down the taller side until
+    // the heights are within 1, links mid there & rebalances on the way
+    // back up: O(height difference + 1).
+    // Goes by the cached height field, so it works in every mode: WAVL
+    // sibling ranks differ by at most 1 (like AVL heights), & nodes on
+    // the join path end up with rank differences of 1 or 2; relaxed
+    // ranks only need to stay above their children's, which every
+    // updateNode keeps.
+    Node *join(Node *left, Node *mid, Node *right)
+    {
+        int leftHeight = getHeight(left);
+        int rightHeight = getHeight(right);
+        if (leftHeight > rightHeight + 1)
+        {
+            left->right = join(left->right, mid, right);
+            return balanceNode(left);
+        }
+        if (rightHeight > leftHeight + 1)
+        {
+            right->left = join(left, mid, right->left);
+            return balanceNode(right);
+        }
+        mid->left = left;
+        mid->right = right;
+        updateNode(mid);
+        return mid;
+    }
+
+    // Unlink the min node of n into minNode; returns what's left
+    Node *detachMin(Node *n, Node *&minNode)
+    {
+        if (n->left == NULL)
+        {
+            minNode = n;
+            return n->right;
+        }
+        n->left = detachMin(n->left, minNode);
+        return balanceNode(n);
+    }
+
+    // Join two trees (every key in left < every key in right)
+    Node *joinTrees(Node *left, Node *right)
+    {
+        if (right == NULL)
+        {
+            return left;
+        }
+        Node *minNode;
+        Node *rest = detachMin(right, minNode);
+        return join(left, minNode, rest);
+    }
+
+    // Split n into keys < key (less), the node equal to key (found,
+    // or NULL), and keys > key (greater). O(log n): the joins on the
+    // way back up telescope.
+    // Tombstones on the path are freed instead of joined back in (a
+    // dead node equal to key gives found = NULL); each costs one more
+    // joinTrees, O(log n).
+    void split(Node *n, const Key &key, Node *&less, Node *&found, Node *&greater)
+    {
+        if (n == NULL)
+        {
+            less = found = greater = NULL;
+            return;
+        }
+        Node *left = n->left;
+        Node *right = n->right;
+        if (compare(key, n->key))
+        {
+            Node *rest;
+            split(left, key, less, found, rest);
+            if (n->dead)
+            {
+                purgeNode(n);
+                greater = joinTrees(rest, right);
+            }
+            else
+            {
+                greater = join(rest, n, right);
+            }
+        }
+        else if (compare(n->key, key))
+        {
+            Node *rest;
+            split(right, key, rest, found, greater);
+            if (n->dead)
+            {
+                purgeNode(n);
+                less = joinTrees(left, rest);
+            }
+            else
+            {
+                less = join(left, n, rest);
+            }
+        }
+        else
+        {
+            less = left;
+            greater = right;
+            found = n;
+            if (n->dead)
+            {
+                purgeNode(n);
+                found = NULL;
+            }
+            else
+            {
+                n->left = n->right = NULL;
+                updateNode(n);
+            }
+        }
+    }
+
+    // Cut n into keys < a, keys in [a, b] & keys > b
+    void splitAround(Node *n, const Key &a, const Key &b, Node *&below, Node *&inRange, Node *&above)
+    {
+        Node *found;
+        Node *rest;
+        split(n, a, below, found, rest);
+        if (found != NULL)
+        {
+            rest = join(NULL, found, rest);
+        }
+        split(rest, b, inRange, found, above);
+        if (found != NULL)
+        {
+            inRange = join(inRange, found, NULL);
+        }
+    }
+
+    // Union of two trees; on equal keys the node from t1 is kept
+    Node *unite(Node *t1, Node *t2)
+    {
+        if (t1 == NULL)
+        {
+            return t2;
+        }
+        if (t2 == NULL)
+        {
+            return t1;
+        }
+        Node *left = t2->left;
+        Node *right = t2->right;
+        Node *less;
+        Node *found;
+        Node *greater;
+        split(t1, t2->key, less, found, greater);
+
+        Node *mid = t2;
+        if (found != NULL)
+        {
+            mid = found;
+            destroyNode(t2);
+        }
+        Node *unitedLeft = unite(less, left);
+        Node *unitedRight = unite(greater, right);
+        return join(unitedLeft, mid, unitedRight);
+    }
+
+    static Value takeValue(Node *n)
+    {
+        if constexpr (std::is_same<Value, NoValue>::value)
+        {
+            return NoValue();
+        }
+        else
+        {
+            return std::move(n->value);
+        }
+    }
+
+    // In order: hand each live node's key & value to visit, then free
+    // it (tombstones are just freed)
+    template <typename Visit>
+    void visitAndDestroy(Node *n, Visit &visit)
+    {
+        if (n == NULL)
+            return;
+        visitAndDestroy(n->left, visit);
+        Node *right = n->right;
+        if (n->dead)
+        {
+            purgeNode(n);
+        }
+        else
+        {
+            visit(std::move(n->key), takeValue(n));
+            destroyNode(n);
+        }
+        visitAndDestroy(right, visit);
+    }
+
+    // Helper function for bulk load
+    // Appends nodes of subtree, in order
+    static void collectNodes(Node *n, std::vector<Node *> &nodes)
+    {
+        if (n == NULL)
+            return;
+        collectNodes(n->left, nodes);
+        nodes.push_back(n);
+        collectNodes(n->right, nodes);
+    }
+
+    // Helper function for bulk load
+    // Links sorted nodes[lo, hi) into a perfectly balanced subtree
+    // (middle node becomes the root, halves become the subtrees)
+    static Node *buildBalanced(const std::vector<Node *> &nodes, size_t lo, size_t hi)
+    {
+        if (lo >= hi)
+        {
+            return NULL;
+        }
+        size_t mid = lo + (hi - lo) / 2;
+        Node *n = nodes[mid];
+        n->left = buildBalanced(nodes, lo, mid);
+        n->right = buildBalanced(nodes, mid + 1, hi);
+        updateNode(n);
+        return n;
+    }
+
+    // build left to right, so an in-order walk goes through memory in order
+    Node *buildSorted(const Key *keys, const Value *values, size_t lo, size_t hi)
+    {
+        if (lo >= hi)
+        {
+            return NULL;
+        }
+        size_t mid = lo + (hi - lo) / 2;
+        Node *left = buildSorted(keys, values, lo, mid);
+        Node *n = createNode(keys[mid], values != NULL ? values[mid] : Value());
+        n->left = left;
+        n->right = buildSorted(keys, values, mid + 1, hi);
+        updateNode(n);
+        return n;
+    }
+
+#ifdef AVL_DEBUG
+    // Returns recomputed height of n; keys must be in (low, high)
+    // (& counts tombstones into dead)
+    int validateSubtree(const Node *n, const Key *low, const Key *high, size_t &dead) const
+    {
+        if (n == NULL)
+        {
+            return 0;
+        }
+        assert(low == NULL || compare(*low, n->key));
+        assert(high == NULL || compare(n->key, *high));
+
+        int leftHeight = validateSubtree(n->left, low, &n->key, dead);
+        int rightHeight = validateSubtree(n->right, &n->key, high, dead);
+        int recomputed = std::max(leftHeight, rightHeight) + 1;
+        assert(n->size == getSize(n->left) + getSize(n->right) + liveCount(n));
+        dead += n->dead;
+
+        if (balance == BALANCE_AVL)
+        {
+            assert(n->height == recomputed);
+            assert(leftHeight - rightHeight <= 1 && rightHeight - leftHeight <= 1);
+            return recomputed;
+        }
+
+        // ranks: every child is a 1- or 2-child, leaves have rank 0
+        // (relaxed: only rank differences >= 1)
+        int leftDiff = n->height - getHeight(n->left);
+        int rightDiff = n->height - getHeight(n->right);
+        assert(leftDiff >= 1 && rightDiff >= 1);
+        if (balance == BALANCE_WAVL)
+        {
+            assert(leftDiff <= 2 && rightDiff <= 2);
+            assert(n->left != NULL || n->right != NULL || n->height == 1);
+        }
+        return recomputed;
+    }
+#endif
+};
+
+#endif
@@ -0,0 +1,882 @@
+// Benchmark driver: runs generated workloads against AvlTree (& the
+// other storage modes of avltree) and std::set, and prints one JSON
+// object per run (JSON lines), e.g.
+//
+//   ./avlbench --sizes 1000,1000000 --workloads uniform,zipf
+//
+// Every run is forked into its own process, so its peak RSS is its own.
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../avl_tree.h"
+#include "../compact_avl_tree.h"
+#include "../eytzinger_snapshot.h"
+#include "../persistent_avl_tree.h"
+#include "../wal.h"
+
+using namespace std;
+
+// keep rotation counts, no tracing
+struct BenchPolicy
+{
+    static const bool tracing = false;
+    static const bool statistics = true;
+
+    static void onTrace(const char *) {}
+
+    template <typename Key>
+    static void onTrace(const char *, const Key &) {}
+};
+
+typedef AvlTree<int, NoValue, less<int>, SlabPool, BenchPolicy> BenchTree;
+
+enum OpKind
+{
+    OP_INSERT,
+    OP_DELETE,
+    OP_SEARCH,
+    OP_RANGE,
+    OP_DELETE_RANGE,
+    OP_MERGE
+};
+
+struct Op
+{
+    OpKind kind;
+    int key;
+};
+
+// keys a range op scans past its start key
+const int RANGE_WIDTH = 100;
+
+// a merge adds the keys key, key + MERGE_STEP, ... up to rangeEnd(key);
+// with 1 key per 4 in the key space that about refills a deleted range
+const int MERGE_STEP = 4;
+
+// Last key of the range starting at key, clamped so it can't overflow
+int rangeEnd(int key)
+{
+    return key > INT_MAX - RANGE_WIDTH ? INT_MAX : key + RANGE_WIDTH;
+}
+
+// lookup cache size for the avlcache impl (--cache)
+size_t cacheEntries = 4096;
+
+// log file of the wal impl (--wal), removed after each run; group
+// commit as in avltree's defaults
+string walPath = "avlbench.wal";
+const size_t WAL_SYNC_OPS = 4096;
+const unsigned int WAL_SYNC_MILLIS = 10;
+
+// WORKLOAD GENERATION
+
+// xorshift64*; deterministic per seed so every impl sees the same ops
+struct Random
+{
+    uint64_t state;
+
+    explicit Random(uint64_t seed) : state(seed * 2685821657736338717ULL | 1) {}
+
+    uint64_t next()
+    {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 2685821657736338717ULL;
+    }
+
+    // uniform in [0, bound)
+    uint64_t below(uint64_t bound)
+    {
+        return next() % bound;
+    }
+
+    double unit()
+    {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+};
+
+// Zipfian ranks in [0, n) with skew theta (Gray et al., as used by YCSB):
+// O(n) setup, O(1) per draw
+struct Zipf
+{
+    uint64_t n;
+    double theta;
+    double alpha;
+    double zetaN;
+    double eta;
+
+    Zipf(uint64_t items, double skew) : n(items), theta(skew)
+    {
+        double zeta2 = 1.0 + pow(0.5, theta);
+        zetaN = 0;
+        for (uint64_t i = 1; i <= n; i++)
+        {
+            zetaN += 1.0 / pow((double)i, theta);
+        }
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetaN);
+    }
+
+    uint64_t next(Random &random)
+    {
+        double u = random.unit();
+        double uz = u * zetaN;
+        if (uz < 1.0)
+        {
+            return 0;
+        }
+        if (uz < 1.0 + pow(0.5, theta))
+        {
+            return 1;
+        }
+        uint64_t rank = (uint64_t)(n * pow(eta * u - eta + 1.0, alpha));
+        return rank < n ? rank : n - 1;
+    }
+};
+
+// Spread a rank over the key space, so hot keys aren't neighbours
+int scramble(uint64_t rank, uint64_t keySpace)
+{
+    return (int)((rank * 11400714819323198485ULL >> 20) % keySpace);
+}
+
+// Keys loaded before the measured ops (not timed), and the measured ops.
+//   uniform:    n random keys, then 50% search / 25% insert / 25% delete
+//   sequential: empty tree, then n ascending inserts (rotation worst case)
+//   zipf:       n keys, then 90% search / 5% insert / 5% delete, zipf 0.99
+//   delete:     n random keys, then 80% delete / 20% insert
+//   range:      n random keys, then 90% range scans / 10% insert
+//   rangeops:   n random keys, then 45% range deletes / 45% merges of
+//               a sorted batch / 10% search
+//   readonly:   n random keys, then 90% search / 10% range scans (no
+//               writes, so the snapshot impl can run it)
+bool generate(const string &workload, size_t n, size_t opCount,
+              vector<int> &preload, vector<Op> &ops)
+{
+    Random random(n + 1);
+    uint64_t keySpace = 4 * (uint64_t)n;
+    if (keySpace > 0x7FFFFFFF)
+    {
+        keySpace = 0x7FFFFFFF;
+    }
+
+    if (workload == "sequential")
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            Op op = {OP_INSERT, (int)i};
+            ops.push_back(op);
+        }
+        return true;
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        preload.push_back((int)random.below(keySpace));
+    }
+
+    if (workload == "uniform")
+    {
+        for (size_t i = 0; i < opCount; i++)
+        {
+            uint64_t r = random.below(4);
+            OpKind kind = r < 2 ? OP_SEARCH : (r == 2 ? OP_INSERT : OP_DELETE);
+            Op op = {kind, (int)random.below(keySpace)};
+            ops.push_back(op);
+        }
+    }
+    else if (workload == "zipf")
+    {
+        Zipf zipf(n, 0.99);
+        for (size_t i = 0; i < opCount; i++)
+        {
+            uint64_t r = random.below(20);
+            OpKind kind = r < 18 ? OP_SEARCH : (r == 18 ? OP_INSERT : OP_DELETE);
+            Op op = {kind, scramble(zipf.next(random), keySpace)};
+            ops.push_back(op);
+        }
+    }
+    else if (workload == "delete")
+    {
+        for (size_t i = 0; i < opCount; i++)
+        {
+            // deletes mostly hit keys that are there
+            bool erase = random.below(5) != 0;
+            int key = erase ? preload[random.below(n)] : (int)random.below(keySpace);
+            Op op = {erase ? OP_DELETE : OP_INSERT, key};
+            ops.push_back(op);
+        }
+    }
+    else if (workload == "range")
+    {
+        for (size_t i = 0; i < opCount; i++)
+        {
+            bool insert = random.below(10) == 0;
+            Op op = {insert ? OP_INSERT : OP_RANGE, (int)random.below(keySpace)};
+            ops.push_back(op);
+        }
+    }
+    else if (workload == "rangeops")
+    {
+        for (size_t i = 0; i < opCount; i++)
+        {
+            uint64_t r = random.below(20);
+            OpKind kind = r < 9 ? OP_DELETE_RANGE : (r < 18 ? OP_MERGE : OP_SEARCH);
+            Op op = {kind, (int)random.below(keySpace)};
+            ops.push_back(op);
+        }
+    }
+    else if (workload == "readonly")
+    {
+        for (size_t i = 0; i < opCount; i++)
+        {
+            bool range = random.below(10) == 0;
+            Op op = {range ? OP_RANGE : OP_SEARCH, (int)random.below(keySpace)};
+            ops.push_back(op);
+        }
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+// true if the workload's measured ops change the keys
+bool writes(const string &workload)
+{
+    return workload != "readonly";
+}
+
+// The sorted keys an OP_MERGE at key adds
+void mergeBatch(int key, vector<int> &keys)
+{
+    keys.clear();
+    int upper = rangeEnd(key);
+    for (long long k = key; k <= upper; k += MERGE_STEP)
+    {
+        keys.push_back((int)k);
+    }
+}
+
+// IMPLEMENTATIONS
+// each runs one op & returns something so the work can't be optimized out
+
+// Mode picks the rebalancing rules (avl, wavl or relaxed),
+// Cached puts the hot-key lookup cache in front
+template <BalanceMode Mode, bool Cached = false>
+struct AvlImpl
+{
+    BenchTree tree;
+    vector<int> batch;
+
+    AvlImpl()
+    {
+        tree.setBalance(Mode);
+        if (Cached)
+        {
+            tree.enableCache(cacheEntries);
+        }
+    }
+
+    void load(const vector<int> &keys)
+    {
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            tree.insert(keys[i]);
+        }
+    }
+
+    size_t run(const Op &op)
+    {
+        switch (op.kind)
+        {
+        case OP_INSERT:
+            return tree.insert(op.key);
+        case OP_DELETE:
+            return tree.erase(op.key);
+        case OP_SEARCH:
+            return tree.contains(op.key);
+        case OP_RANGE:
+        {
+            size_t count = 0;
+            int upper = rangeEnd(op.key);
+            BenchTree::RangeCursor cursor;
+            cursor.start(tree, op.key, upper);
+            while (cursor.next() != NULL)
+            {
+                count++;
+            }
+            return count;
+        }
+        case OP_DELETE_RANGE:
+            return tree.eraseRange(op.key, rangeEnd(op.key));
+        case OP_MERGE:
+            mergeBatch(op.key, batch);
+            tree.mergeSorted(batch.data(), batch.size());
+            return tree.size();
+        }
+        return 0;
+    }
+
+    unsigned long long rotations() const
+    {
+        const TreeStats &stats = tree.statistics();
+        return stats.llRotations + stats.rrRotations + stats.lrRotations + stats.rlRotations;
+    }
+};
+
+struct SetImpl
+{
+    set<int> tree;
+    vector<int> batch;
+
+    void load(const vector<int> &keys)
+    {
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            tree.insert(keys[i]);
+        }
+    }
+
+    size_t run(const Op &op)
+    {
+        switch (op.kind)
+        {
+        case OP_INSERT:
+            return tree.insert(op.key).second;
+        case OP_DELETE:
+            return tree.erase(op.key);
+        case OP_SEARCH:
+            return tree.count(op.key);
+        case OP_RANGE:
+        {
+            size_t count = 0;
+            set<int>::const_iterator it = tree.lower_bound(op.key);
+            int upper = rangeEnd(op.key);
+            for (; it != tree.end() && *it <= upper; ++it)
+            {
+                count++;
+            }
+            return count;
+        }
+        case OP_DELETE_RANGE:
+        {
+            set<int>::iterator first = tree.lower_bound(op.key);
+            set<int>::iterator last = tree.upper_bound(rangeEnd(op.key));
+            size_t count = distance(first, last);
+            tree.erase(first, last);
+            return count;
+        }
+        case OP_MERGE:
+            mergeBatch(op.key, batch);
+            tree.insert(batch.begin(), batch.end());
+            return tree.size();
+        }
+        return 0;
+    }
+
+    // std::set doesn't say
+    long long rotations() const { return -1; }
+};
+
+// --compact: 12-byte index-linked nodes in one vector
+struct CompactImpl
+{
+    CompactAvlTree<int> tree;
+    vector<int> batch;
+
+    void load(const vector<int> &keys)
+    {
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            tree.insert(keys[i]);
+        }
+    }
+
+    size_t run(const Op &op)
+    {
+        switch (op.kind)
+        {
+        case OP_INSERT:
+            return tree.insert(op.key);
+        case OP_DELETE:
+            return tree.erase(op.key);
+        case OP_SEARCH:
+            return tree.contains(op.key);
+        case OP_RANGE:
+            return scan(op.key, NULL);
+        case OP_DELETE_RANGE:
+        {
+            // no split & join here: collect the keys, then erase each
+            vector<int> removed;
+            scan(op.key, &removed);
+            for (size_t i = 0; i < removed.size(); i++)
+            {
+                tree.erase(removed[i]);
+            }
+            return removed.size();
+        }
+        case OP_MERGE:
+            mergeBatch(op.key, batch);
+            for (size_t i = 0; i < batch.size(); i++)
+            {
+                tree.insert(batch[i]);
+            }
+            return tree.size();
+        }
+        return 0;
+    }
+
+    // count (& optionally collect) the keys in the range at key
+    size_t scan(int key, vector<int> *keys)
+    {
+        size_t count = 0;
+        int upper = rangeEnd(key);
+        CompactAvlTree<int>::RangeCursor cursor;
+        cursor.start(tree, key, upper);
+        while (const int *found = cursor.next())
+        {
+            if (keys != NULL)
+            {
+                keys->push_back(*found);
+            }
+            count++;
+        }
+        return count;
+    }
+
+    long long rotations() const { return -1; }
+};
+
+// --mvcc: copy-on-write tree; every read pins the current version
+// like avltree's own thread does
+struct MvccImpl
+{
+    typedef PersistentAvlTree<int> Tree;
+
+    Tree tree;
+    int reader;
+    vector<int> batch;
+
+    MvccImpl() { reader = tree.registerReader(); }
+
+    void load(const vector<int> &keys)
+    {
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            tree.insert(keys[i]);
+        }
+    }
+
+    size_t run(const Op &op)
+    {
+        switch (op.kind)
+        {
+        case OP_INSERT:
+            return tree.insert(op.key);
+        case OP_DELETE:
+            return tree.erase(op.key);
+        case OP_SEARCH:
+        {
+            Tree::ReadGuard version(tree, reader);
+            return version.contains(op.key);
+        }
+        case OP_RANGE:
+            return scan(op.key, NULL);
+        case OP_DELETE_RANGE:
+        {
+            vector<int> removed;
+            scan(op.key, &removed);
+            for (size_t i = 0; i < removed.size(); i++)
+            {
+                tree.erase(removed[i]);
+            }
+            return removed.size();
+        }
+        case OP_MERGE:
+            mergeBatch(op.key, batch);
+            for (size_t i = 0; i < batch.size(); i++)
+            {
+                tree.insert(batch[i]);
+            }
+            return size();
+        }
+        return 0;
+    }
+
+    size_t scan(int key, vector<int> *keys)
+    {
+        size_t count = 0;
+        int upper = rangeEnd(key);
+        Tree::ReadGuard version(tree, reader);
+        Tree::RangeCursor cursor;
+        cursor.start(version, key, upper);
+        while (const int *found = cursor.next())
+        {
+            if (keys != NULL)
+            {
+                keys->push_back(*found);
+            }
+            count++;
+        }
+        return count;
+    }
+
+    size_t size()
+    {
+        Tree::ReadGuard version(tree, reader);
+        return version.size();
+    }
+
+    long long rotations() const { return -1; }
+};
+
+// Freeze(): the keys in a read-only Eytzinger array; read-only
+// workloads only (see writes())
+struct SnapshotImpl
+{
+    EytzingerSnapshot<int> snapshot;
+
+    void load(const vector<int> &keys)
+    {
+        vector<int> sorted(keys);
+        sort(sorted.begin(), sorted.end());
+        sorted.erase(unique(sorted.begin(), sorted.end()), sorted.end());
+        snapshot.build(sorted);
+    }
+
+    size_t run(const Op &op)
+    {
+        switch (op.kind)
+        {
+        case OP_SEARCH:
+            return snapshot.contains(op.key);
+        case OP_RANGE:
+        {
+            size_t count = 0;
+            int upper = rangeEnd(op.key);
+            EytzingerSnapshot<int>::RangeCursor cursor;
+            cursor.start(snapshot, op.key, upper);
+            while (cursor.next() != NULL)
+            {
+                count++;
+            }
+            return count;
+        }
+        default:
+            // never generated for it
+            return 0;
+        }
+    }
+
+    long long rotations() const { return -1; }
+};
+
+// --wal: the default tree with every mutation logged first, with
+// avltree's group commit
+struct WalImpl
+{
+    AvlImpl<BALANCE_AVL> inner;
+    WriteAheadLog wal;
+    vector<int> batch;
+
+    WalImpl()
+    {
+        unlink(walPath.c_str());
+        if (!wal.open(walPath, WAL_SYNC_OPS, WAL_SYNC_MILLIS))
+        {
+            fprintf(stderr, "could not open %s\n", walPath.c_str());
+            exit(1);
+        }
+    }
+
+    ~WalImpl()
+    {
+        wal.close();
+        unlink(walPath.c_str());
+    }
+
+    void load(const vector<int> &keys)
+    {
+        // preloaded keys count as checkpointed, like a BulkInsert
+        inner.load(keys);
+    }
+
+    size_t run(const Op &op)
+    {
+        bool logged = true;
+        switch (op.kind)
+        {
+        case OP_INSERT:
+            logged = wal.append(WAL_INSERT, op.key);
+            break;
+        case OP_DELETE:
+            logged = wal.append(WAL_DELETE, op.key);
+            break;
+        case OP_DELETE_RANGE:
+            logged = wal.appendDeleteRange(op.key, rangeEnd(op.key));
+            break;
+        case OP_MERGE:
+            // avltree checkpoints after a Merge; log the keys instead
+            mergeBatch(op.key, batch);
+            for (size_t i = 0; i < batch.size(); i++)
+            {
+                logged = wal.append(WAL_INSERT, batch[i]) && logged;
+            }
+            break;
+        default:
+            break;
+        }
+        if (!logged)
+        {
+            fprintf(stderr, "write-ahead log failed\n");
+            exit(1);
+        }
+        return inner.run(op);
+    }
+
+    unsigned long long rotations() const { return inner.rotations(); }
+};
+
+// MEASUREMENT
+
+struct Result
+{
+    double seconds;
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t p999;
+    double rotationsPerOp; // < 0 if unknown
+    size_t checksum;
+};
+
+uint64_t percentile(vector<uint32_t> &latencies, double fraction)
+{
+    size_t k = (size_t)(fraction * (latencies.size() - 1));
+    nth_element(latencies.begin(), latencies.begin() + k, latencies.end());
+    return latencies[k];
+}
+
+// Time every op on its own for the latency percentiles; throughput is
+// measured over the whole loop (so it includes the clock reads)
+template <typename Impl>
+Result measure(const vector<int> &preload, const vector<Op> &ops)
+{
+    Impl impl;
+    impl.load(preload);
+    double rotationsBefore = impl.rotations();
+
+    vector<uint32_t> latencies(ops.size());
+    size_t checksum = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    chrono::steady_clock::time_point last = start;
+    for (size_t i = 0; i < ops.size(); i++)
+    {
+        checksum += impl.run(ops[i]);
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        latencies[i] = (uint32_t)chrono::duration_cast<chrono::nanoseconds>(now - last).count();
+        last = now;
+    }
+
+    Result result;
+    result.seconds = chrono::duration<double>(last - start).count();
+    result.rotationsPerOp = rotationsBefore < 0 || ops.empty() ? -1 : (impl.rotations() - rotationsBefore) / ops.size();
+    result.checksum = checksum;
+    result.p50 = result.p99 = result.p999 = 0;
+    if (!latencies.empty())
+    {
+        result.p50 = percentile(latencies, 0.50);
+        result.p99 = percentile(latencies, 0.99);
+        result.p999 = percentile(latencies, 0.999);
+    }
+    return result;
+}
+
+// Generate, run & print one run; called in a child process
+void runOne(const string &workload, const string &impl, size_t n, size_t opLimit)
+{
+    vector<int> preload;
+    vector<Op> ops;
+    size_t opCount = min(n, opLimit);
+    if (!generate(workload, n, opCount, preload, ops))
+    {
+        fprintf(stderr, "unknown workload %s\n", workload.c_str());
+        exit(1);
+    }
+
+    if (impl == "snapshot" && writes(workload))
+    {
+        fprintf(stderr, "skipping %s/snapshot: the snapshot is read-only\n", workload.c_str());
+        return;
+    }
+
+    Result result;
+    if (impl == "avl")
+    {
+        result = measure<AvlImpl<BALANCE_AVL>>(preload, ops);
+    }
+    else if (impl == "avlcache")
+    {
+        result = measure<AvlImpl<BALANCE_AVL, true>>(preload, ops);
+    }
+    else if (impl == "wavl")
+    {
+        result = measure<AvlImpl<BALANCE_WAVL>>(preload, ops);
+    }
+    else if (impl == "relaxed")
+    {
+        result = measure<AvlImpl<BALANCE_RELAXED>>(preload, ops);
+    }
+    else if (impl == "compact")
+    {
+        result = measure<CompactImpl>(preload, ops);
+    }
+    else if (impl == "mvcc")
+    {
+        result = measure<MvccImpl>(preload, ops);
+    }
+    else if (impl == "snapshot")
+    {
+        result = measure<SnapshotImpl>(preload, ops);
+    }
+    else if (impl == "wal")
+    {
+        result = measure<WalImpl>(preload, ops);
+    }
+    else if (impl == "set")
+    {
+        result = measure<SetImpl>(preload, ops);
+    }
+    else
+    {
+        fprintf(stderr, "unknown impl %s\n", impl.c_str());
+        exit(1);
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("{\"workload\": \"%s\", \"impl\": \"%s\", \"keys\": %zu, \"ops\": %zu, "
+           "\"ops_per_sec\": %.0f, \"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, "
+           "\"peak_rss_kb\": %ld, \"rotations_per_op\": ",
+           workload.c_str(), impl.c_str(), n, ops.size(),
+           result.seconds > 0 ? ops.size() / result.seconds : 0.0,
+           (unsigned long long)result.p50, (unsigned long long)result.p99,
+           (unsigned long long)result.p999, usage.ru_maxrss);
+    if (result.rotationsPerOp < 0)
+    {
+        printf("null");
+    }
+    else
+    {
+        printf("%.4f", result.rotationsPerOp);
+    }
+    printf(", \"checksum\": %zu}\n", result.checksum);
+}
+
+// Split "a,b,c" into its parts
+vector<string> splitList(const string &list)
+{
+    vector<string> parts;
+    size_t begin = 0;
+    while (begin <= list.size())
+    {
+        size_t end = list.find(',', begin);
+        if (end == string::npos)
+        {
+            end = list.size();
+        }
+        if (end > begin)
+        {
+            parts.push_back(list.substr(begin, end - begin));
+        }
+        begin = end + 1;
+    }
+    return parts;
+}
+
+int main(int argc, char **argv)
+{
+    vector<string> workloads = splitList("uniform,sequential,zipf,delete,range,rangeops,readonly");
+    vector<string> impls = splitList("avl,set");
+    vector<string> sizes = splitList("1000,10000,100000,1000000");
+    size_t opLimit = 1000000;
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        string arg = argv[i];
+        if (arg == "--workloads")
+        {
+            workloads = splitList(argv[i + 1]);
+        }
+        else if (arg == "--impls")
+        {
+            impls = splitList(argv[i + 1]);
+        }
+        else if (arg == "--sizes")
+        {
+            // e.g. 1000,1000000,100000000
+            sizes = splitList(argv[i + 1]);
+        }
+        else if (arg == "--cache")
+        {
+            // entries in the avlcache impl's lookup cache
+            cacheEntries = strtoull(argv[i + 1], NULL, 10);
+        }
+        else if (arg == "--wal")
+        {
+            // log file for the wal impl
+            walPath = argv[i + 1];
+        }
+        else if (arg == "--ops")
+        {
+            // cap on measured ops per run (default: min(keys, 1M))
+            opLimit = strtoull(argv[i + 1], NULL, 10);
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [--workloads list] [--impls avl,avlcache,wavl,relaxed,compact,mvcc,snapshot,wal,set] [--sizes list] [--ops max] [--cache entries] [--wal path]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    for (size_t w = 0; w < workloads.size(); w++)
+    {
+        for (size_t s = 0; s < sizes.size(); s++)
+        {
+            for (size_t m = 0; m < impls.size(); m++)
+            {
+                fflush(stdout);
+                pid_t child = fork();
+                if (child == 0)
+                {
+                    runOne(workloads[w], impls[m], strtoull(sizes[s].c_str(), NULL, 10), opLimit);
+                    fflush(stdout);
+                    _exit(0);
+                }
+                int status;
+                waitpid(child, &status, 0);
+                if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                {
+                    fprintf(stderr, "run %s/%s/%s failed\n", workloads[w].c_str(), impls[m].c_str(), sizes[s].c_str());
+                }
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,369 @@
+#include "command_parser.h"
+
+#include <cstring>
+#include <climits>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// what goes between a command's parentheses
+enum ArgKind
+{
+    ARGS_INTS,      // comma separated integers
+    ARGS_PATH,      // raw text (a file path)
+    ARGS_NAME_INTS  // a word (e.g. an operation), then integers
+};
+
+// command names & how many arguments each takes
+struct CommandSpec
+{
+    const char *name;
+    size_t nameLength;
+    CommandType type;
+    int minArgs; // integers only
+    int maxArgs;
+    ArgKind argKind;
+};
+
+static const CommandSpec commandSpecs[] = {
+    {"Initialize", 10, CMD_INITIALIZE, 0, 0, ARGS_INTS},
+    {"Insert", 6, CMD_INSERT, 1, 1, ARGS_INTS},
+    {"Delete", 6, CMD_DELETE, 1, 1, ARGS_INTS},
+    {"Search", 6, CMD_SEARCH, 1, 3, ARGS_INTS},
+    {"Count", 5, CMD_COUNT, 2, 2, ARGS_INTS},
+    {"Rank", 4, CMD_RANK, 1, 1, ARGS_INTS},
+    {"Select", 6, CMD_SELECT, 1, 1, ARGS_INTS},
+    {"BulkInsert", 10, CMD_BULK_INSERT, 0, 0, ARGS_PATH},
+    {"AllocatorStats", 14, CMD_ALLOCATOR_STATS, 0, 0, ARGS_INTS},
+    {"Freeze", 6, CMD_FREEZE, 0, 0, ARGS_INTS},
+    {"SearchMany", 10, CMD_SEARCH_MANY, 1, MAX_COMMAND_ARGS, ARGS_INTS},
+    {"Stats", 5, CMD_STATS, 0, 0, ARGS_INTS},
+    {"Save", 4, CMD_SAVE, 0, 0, ARGS_PATH},
+    {"Load", 4, CMD_LOAD, 0, 0, ARGS_PATH},
+    {"Checkpoint", 10, CMD_CHECKPOINT, 0, 0, ARGS_INTS},
+    {"DeleteRange", 11, CMD_DELETE_RANGE, 2, 2, ARGS_INTS},
+    {"ExtractRange", 12, CMD_EXTRACT_RANGE, 2, 2, ARGS_INTS},
+    {"Merge", 5, CMD_MERGE, 0, 0, ARGS_PATH},
+    {"Floor", 5, CMD_FLOOR, 1, 1, ARGS_INTS},
+    {"Ceiling", 7, CMD_CEILING, 1, 1, ARGS_INTS},
+    {"Pred", 4, CMD_PRED, 1, 1, ARGS_INTS},
+    {"Succ", 4, CMD_SUCC, 1, 1, ARGS_INTS},
+    {"Aggregate", 9, CMD_AGGREGATE, 2, 2, ARGS_NAME_INTS},
+    {"Upsert", 6, CMD_UPSERT, 2, 2, ARGS_INTS},
+    {"GetOrInsert", 11, CMD_GET_OR_INSERT, 2, 2, ARGS_INTS},
+    {"Increment", 9, CMD_INCREMENT, 2, 2, ARGS_INTS},
+};
+
+static const size_t commandSpecCount = sizeof(commandSpecs) / sizeof(commandSpecs[0]);
+
+static bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static bool isLetter(char c)
+{
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+}
+
+// Hand-rolled integer decoder: [spaces][+|-]digits[spaces]
+// Advances p past what it read; returns false if no valid int is there
+static bool decodeInt(const char *&p, const char *end, int &value)
+{
+    while (p < end && isSpace(*p))
+    {
+        p++;
+    }
+
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = (*p == '-');
+        p++;
+    }
+
+    const char *digitsStart = p;
+    long long magnitude = 0;
+    while (p < end && *p >= '0' && *p <= '9')
+    {
+        magnitude = magnitude * 10 + (*p - '0');
+        if (magnitude > (long long)INT_MAX + 1)
+        {
+            // out of range for an int
+            return false;
+        }
+        p++;
+    }
+    if (p == digitsStart)
+    {
+        return false;
+    }
+    if (!negative && magnitude > INT_MAX)
+    {
+        return false;
+    }
+
+    while (p < end && isSpace(*p))
+    {
+        p++;
+    }
+    value = (int)(negative ? -magnitude : magnitude);
+    return true;
+}
+
+CommandParser::CommandParser()
+{
+    data = NULL;
+    length = 0;
+    pos = NULL;
+    end = NULL;
+    lineNumber = 0;
+    errors = 0;
+}
+
+CommandParser::~CommandParser()
+{
+    close();
+}
+
+bool CommandParser::open(const string &fileName)
+{
+    close();
+
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    length = info.st_size;
+
+    // empty file can't be mapped, but is a valid (empty) input
+    if (length > 0)
+    {
+        void *mapped = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED)
+        {
+            ::close(fd);
+            length = 0;
+            return false;
+        }
+        data = static_cast<const char *>(mapped);
+
+        // input is read front to back exactly once
+        madvise(mapped, length, MADV_SEQUENTIAL);
+    }
+    ::close(fd);
+
+    pos = data;
+    end = data + length;
+    lineNumber = 0;
+    errors = 0;
+    return true;
+}
+
+void CommandParser::attach(const char *text, size_t textLength)
+{
+    close();
+    pos = text;
+    end = text + textLength;
+}
+
+void CommandParser::close()
+{
+    if (data != NULL)
+    {
+        munmap(const_cast<char *>(data), length);
+    }
+    data = NULL;
+    length = 0;
+    pos = NULL;
+    end = NULL;
+}
+
+bool CommandParser::next(Command &command)
+{
+    while (pos < end)
+    {
+        // find end of this line
+        const char *line = pos;
+        const char *lineEnd = static_cast<const char *>(memchr(pos, '\n', end - pos));
+        if (lineEnd == NULL)
+        {
+            lineEnd = end;
+        }
+        pos = lineEnd + 1;
+        lineNumber++;
+
+        if (parseLine(line, lineEnd, command))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Tokenize one line in place: Name(arg, arg, ...)
+// Returns false for blank & malformed lines
+bool CommandParser::parseLine(const char *line, const char *lineEnd, Command &command)
+{
+    const char *p = line;
+    while (p < lineEnd && isSpace(*p))
+    {
+        p++;
+    }
+    while (lineEnd > p && isSpace(lineEnd[-1]))
+    {
+        lineEnd--;
+    }
+    if (p == lineEnd)
+    {
+        // blank line; nothing to do
+        return false;
+    }
+
+    // command name
+    const char *name = p;
+    while (p < lineEnd && isLetter(*p))
+    {
+        p++;
+    }
+    size_t nameLength = p - name;
+
+    const CommandSpec *spec = NULL;
+    for (size_t i = 0; i < commandSpecCount; i++)
+    {
+        if (commandSpecs[i].nameLength == nameLength && memcmp(commandSpecs[i].name, name, nameLength) == 0)
+        {
+            spec = &commandSpecs[i];
+            break;
+        }
+    }
+    if (spec == NULL)
+    {
+        reject(line, lineEnd, "unknown command");
+        return false;
+    }
+
+    // argument list must be wrapped in parentheses
+    if (p == lineEnd || *p != '(' || lineEnd[-1] != ')')
+    {
+        reject(line, lineEnd, "expected '(' arguments ')'");
+        return false;
+    }
+    const char *argsStart = p + 1;
+    const char *argsEnd = lineEnd - 1;
+
+    command.type = spec->type;
+    command.argCount = 0;
+    command.text = argsStart;
+    command.textLength = argsEnd - argsStart;
+    command.lineNumber = lineNumber;
+
+    if (spec->argKind == ARGS_PATH)
+    {
+        // trim spaces around the path
+        while (command.textLength > 0 && isSpace(*command.text))
+        {
+            command.text++;
+            command.textLength--;
+        }
+        while (command.textLength > 0 && isSpace(command.text[command.textLength - 1]))
+        {
+            command.textLength--;
+        }
+        if (command.textLength == 0)
+        {
+            reject(line, lineEnd, "missing path");
+            return false;
+        }
+        return true;
+    }
+
+    p = argsStart;
+    if (spec->argKind == ARGS_NAME_INTS)
+    {
+        // leading word goes in text, integers follow the comma
+        while (p < argsEnd && isSpace(*p))
+        {
+            p++;
+        }
+        command.text = p;
+        while (p < argsEnd && isLetter(*p))
+        {
+            p++;
+        }
+        command.textLength = p - command.text;
+        while (p < argsEnd && isSpace(*p))
+        {
+            p++;
+        }
+        if (command.textLength == 0 || p == argsEnd || *p != ',')
+        {
+            reject(line, lineEnd, "expected a name, then integers");
+            return false;
+        }
+        p++;
+    }
+
+    // comma separated integers
+    const char *q = p;
+    while (q < argsEnd && isSpace(*q))
+    {
+        q++;
+    }
+    if (q != argsEnd)
+    {
+        while (true)
+        {
+            if (command.argCount == MAX_COMMAND_ARGS)
+            {
+                reject(line, lineEnd, "wrong number of arguments");
+                return false;
+            }
+            if (!decodeInt(p, argsEnd, command.args[command.argCount]))
+            {
+                reject(line, lineEnd, "bad integer argument");
+                return false;
+            }
+            command.argCount++;
+
+            if (p == argsEnd)
+            {
+                break;
+            }
+            if (*p != ',')
+            {
+                reject(line, lineEnd, "bad integer argument");
+                return false;
+            }
+            p++;
+        }
+    }
+
+    if (command.argCount < spec->minArgs || command.argCount > spec->maxArgs)
+    {
+        reject(line, lineEnd, "wrong number of arguments");
+        return false;
+    }
+    return true;
+}
+
+// Report a malformed line along with where it is
+void CommandParser::reject(const char *line, const char *lineEnd, const char *reason)
+{
+    errors++;
+    cerr << "Line " << lineNumber << ": " << reason << ": ";
+    cerr.write(line, lineEnd - line);
+    cerr << ". Moving on to next command." << endl;
+}
@@ -0,0 +1,96 @@
+#ifndef COMMAND_PARSER_H
+#define COMMAND_PARSER_H
+
+#include <cstddef>
+#include <string>
+
+// every command the input file can contain
+enum CommandType
+{
+    CMD_INITIALIZE,
+    CMD_INSERT,
+    CMD_DELETE,
+    CMD_SEARCH,
+    CMD_COUNT,
+    CMD_RANK,
+    CMD_SELECT,
+    CMD_BULK_INSERT,
+    CMD_ALLOCATOR_STATS,
+    CMD_FREEZE,
+    CMD_SEARCH_MANY,
+    CMD_STATS,
+    CMD_SAVE,
+    CMD_LOAD,
+    CMD_CHECKPOINT,
+    CMD_DELETE_RANGE,
+    CMD_EXTRACT_RANGE,
+    CMD_MERGE,
+    CMD_FLOOR,
+    CMD_CEILING,
+    CMD_PRED,
+    CMD_SUCC,
+    CMD_AGGREGATE,
+    CMD_UPSERT,
+    CMD_GET_OR_INSERT,
+    CMD_INCREMENT
+};
+
+// most integer arguments any command takes
+const int MAX_COMMAND_ARGS = 64;
+
+// one parsed line of input
+struct Command
+{
+    CommandType type;
+    int args[MAX_COMMAND_ARGS];
+    int argCount;
+
+    // raw text between the parentheses, for commands taking a path
+    // (or the leading name, for Aggregate); points into the mapped
+    // file, so it isn't NUL terminated
+    const char *text;
+    size_t textLength;
+
+    size_t lineNumber;
+};
+
+// Reads commands straight out of a memory-mapped input file.
+// Lines are tokenized in place (no copies, no per-line allocation),
+// and malformed lines are reported with their line number & skipped.
+class CommandParser
+{
+public:
+    CommandParser();
+    ~CommandParser();
+
+    // Map the input file; returns false if it can't be opened
+    bool open(const std::string &fileName);
+    // Parse whole lines held in memory instead (not copied, so they
+    // must stay put until the last command from them is used). Line
+    // numbers & the error count carry on from before.
+    void attach(const char *text, size_t textLength);
+    void close();
+
+    // true once every line has been read
+    bool atEnd() const { return pos >= end; }
+
+    // Parse the next valid command into command.
+    // Returns false once the end of the file is reached.
+    bool next(Command &command);
+
+    // number of lines rejected so far
+    size_t errorCount() const { return errors; }
+
+private:
+    const char *data;
+    size_t length;
+    const char *pos;
+    const char *end;
+    size_t lineNumber;
+    size_t errors;
+
+    bool parseLine(const char *line, const char *lineEnd, Command &command);
+    void reject(const char *line, const char *lineEnd, const char *reason);
+};
+
+#endif
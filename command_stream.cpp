@@ -0,0 +1,269 @@
+#include "command_stream.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+using namespace std;
+
+CommandStream::CommandStream() : stopping(false), closing(false)
+{
+    fd = -1;
+    ownsFd = false;
+    follow = false;
+    finished = true;
+    current = NULL;
+    nextBuffer = 0;
+    totalBytes = 0;
+    readerStalls = 0;
+    treeStalls = 0;
+    for (int i = 0; i < 2; i++)
+    {
+        buffers[i].used = 0;
+        buffers[i].ready = false;
+    }
+}
+
+CommandStream::~CommandStream()
+{
+    close();
+}
+
+bool CommandStream::open(const string &fileName, bool followInput, size_t bufferBytes)
+{
+    close();
+    if (fileName == "-")
+    {
+        fd = STDIN_FILENO;
+        ownsFd = false;
+    }
+    else
+    {
+        // (a FIFO blocks here until its producer opens it)
+        fd = ::open(fileName.c_str(), O_RDONLY);
+        ownsFd = true;
+    }
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    follow = followInput;
+    stopping.store(false);
+    closing.store(false);
+    for (int i = 0; i < 2; i++)
+    {
+        buffers[i].bytes.assign(bufferBytes < 4096 ? 4096 : bufferBytes, '\0');
+        buffers[i].used = 0;
+        buffers[i].ready = false;
+    }
+    finished = false;
+    current = NULL;
+    nextBuffer = 0;
+    reader = thread(&CommandStream::readLoop, this);
+    return true;
+}
+
+void CommandStream::close()
+{
+    if (reader.joinable())
+    {
+        {
+            // let the reader out of a wait for a free buffer, & out of
+            // a wait for input that may never come (e.g. an idle pipe)
+            lock_guard<mutex> guard(lock);
+            closing.store(true);
+        }
+        stop();
+        freed.notify_one();
+        reader.join();
+    }
+    parser.close();
+    current = NULL;
+    if (fd >= 0 && ownsFd)
+    {
+        ::close(fd);
+    }
+    fd = -1;
+}
+
+bool CommandStream::next(Command &command)
+{
+    while (true)
+    {
+        if (current != NULL && parser.next(command))
+        {
+            return true;
+        }
+
+        unique_lock<mutex> guard(lock);
+        if (current != NULL)
+        {
+            // every command from it is done; hand it back to the reader
+            current->ready = false;
+            current = NULL;
+            freed.notify_one();
+        }
+        Buffer &buffer = buffers[nextBuffer];
+        if (!buffer.ready && !finished)
+        {
+            treeStalls++;
+            filled.wait(guard, [this, &buffer]
+                        { return buffer.ready || finished; });
+        }
+        if (!buffer.ready)
+        {
+            // end of the stream
+            return false;
+        }
+        current = &buffer;
+        nextBuffer ^= 1;
+        guard.unlock();
+        parser.attach(buffer.bytes.data(), buffer.used);
+    }
+}
+
+bool CommandStream::wouldWait()
+{
+    if (current != NULL && !parser.atEnd())
+    {
+        return false;
+    }
+    lock_guard<mutex> guard(lock);
+    return !buffers[nextBuffer].ready && !finished;
+}
+
+// Reader thread: fill the buffers in turn & hand them to the tree thread
+void CommandStream::readLoop()
+{
+    // partial line at the end of the last buffer
+    string carry;
+    int index = 0;
+    bool ended = false;
+    while (!ended)
+    {
+        Buffer &buffer = buffers[index];
+        {
+            unique_lock<mutex> guard(lock);
+            if (buffer.ready)
+            {
+                // both buffers are full: wait for the tree thread
+                readerStalls++;
+                freed.wait(guard, [this, &buffer]
+                           { return !buffer.ready || closing.load(); });
+            }
+            if (closing.load())
+            {
+                return;
+            }
+        }
+
+        if (buffer.bytes.size() < carry.size() * 2)
+        {
+            buffer.bytes.resize(carry.size() * 2);
+        }
+        memcpy(buffer.bytes.data(), carry.data(), carry.size());
+        buffer.used = carry.size();
+        size_t lineEnd = 0;
+        ended = fill(buffer, lineEnd);
+
+        // keep a trailing partial line for the next buffer (at the end
+        // of the input it's just the last line)
+        size_t whole = ended ? buffer.used : lineEnd;
+        carry.assign(buffer.bytes.data() + whole, buffer.used - whole);
+        buffer.used = whole;
+
+        {
+            lock_guard<mutex> guard(lock);
+            buffer.ready = true;
+            finished = ended;
+        }
+        filled.notify_one();
+        index ^= 1;
+    }
+}
+
+// Read into buffer until it's full, no more input is ready (once it
+// has a whole line), or the input ends; returns true at the end.
+// lineEnd is kept just past the last newline in buffer (0 if none).
+bool CommandStream::fill(Buffer &buffer, size_t &lineEnd)
+{
+    while (true)
+    {
+        if (closing.load())
+        {
+            return true;
+        }
+        if (buffer.used == buffer.bytes.size())
+        {
+            if (lineEnd > 0)
+            {
+                return false;
+            }
+            // a single line bigger than the buffer
+            buffer.bytes.resize(buffer.bytes.size() * 2);
+        }
+        if (lineEnd > 0 && !inputReady())
+        {
+            // don't sit on whole lines while the producer is quiet
+            return false;
+        }
+        // wait in poll() rather than read(), so stop() & close() get
+        // noticed even if a pipe or FIFO goes quiet without closing
+        while (!inputReady())
+        {
+            if (stopping.load())
+            {
+                return true;
+            }
+            struct pollfd wait = {fd, POLLIN, 0};
+            poll(&wait, 1, POLL_MICROS / 1000);
+        }
+
+        ssize_t bytes = read(fd, buffer.bytes.data() + buffer.used, buffer.bytes.size() - buffer.used);
+        if (bytes < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            cerr << "Input stream: read failed" << endl;
+            return true;
+        }
+        if (bytes == 0)
+        {
+            // end of the input; a followed one may still grow
+            if (!follow || stopping.load())
+            {
+                return true;
+            }
+            if (lineEnd > 0)
+            {
+                return false;
+            }
+            usleep(POLL_MICROS);
+            continue;
+        }
+
+        for (size_t i = buffer.used + bytes; i > buffer.used; i--)
+        {
+            if (buffer.bytes[i - 1] == '\n')
+            {
+                lineEnd = i;
+                break;
+            }
+        }
+        buffer.used += bytes;
+        totalBytes += bytes;
+    }
+}
+
+// true if a read() wouldn't block (data, end of input, or an error)
+bool CommandStream::inputReady() const
+{
+    struct pollfd check = {fd, POLLIN, 0};
+    return poll(&check, 1, 0) > 0;
+}
@@ -0,0 +1,98 @@
+#ifndef COMMAND_STREAM_H
+#define COMMAND_STREAM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "command_parser.h"
+
+// Reads commands from a stream: stdin, a pipe/FIFO, or a file that is
+// still being written (--stream, --follow).
+//
+// Two large buffers take turns. While the tree thread parses & applies
+// the commands of one (in place, like a mapped file), a reader thread
+// read()s the next lines into the other. A buffer only ever holds whole
+// lines (a partial line is carried over to the next one), so command
+// text can point into it until the tree thread moves on.
+//
+// The reader waits when both buffers are full (backpressure), and hands
+// a buffer over as soon as no more input is ready, so a slow producer's
+// lines aren't held back until a buffer fills.
+class CommandStream
+{
+public:
+    CommandStream();
+    ~CommandStream();
+
+    // Start reading fileName ("-" is stdin) with two buffers of about
+    // bufferBytes each. With follow, reaching the end of the input
+    // doesn't end the stream: it is polled for more until stop().
+    // Returns false if the input can't be opened.
+    bool open(const std::string &fileName, bool follow, size_t bufferBytes);
+    // Stop the reader & wait for it; input not read yet is dropped
+    void close();
+
+    // Parse the next valid command into command, waiting for input if
+    // needed. Returns false once the stream has ended.
+    bool next(Command &command);
+
+    // true if next() would have to wait for the reader
+    bool wouldWait();
+
+    // End a followed stream at its current end (async-signal-safe)
+    void stop() { stopping.store(true); }
+
+    // number of lines rejected so far
+    size_t errorCount() const { return parser.errorCount(); }
+
+    // bytes read, & how often each side had to wait for the other
+    size_t bytesRead() const { return totalBytes; }
+    size_t readerWaits() const { return readerStalls; }
+    size_t treeWaits() const { return treeStalls; }
+
+private:
+    struct Buffer
+    {
+        std::vector<char> bytes;
+        size_t used;
+        // filled & waiting for (or in use by) the tree thread
+        bool ready;
+    };
+
+    // how long the reader waits for input (or a followed input sleeps
+    // at its end) before looking again
+    static const unsigned int POLL_MICROS = 10000;
+
+    int fd;
+    bool ownsFd;
+    bool follow;
+    std::atomic<bool> stopping;
+    // close() was called: nobody wants the rest of the input
+    std::atomic<bool> closing;
+
+    Buffer buffers[2];
+    std::mutex lock;
+    std::condition_variable filled; // reader -> tree thread
+    std::condition_variable freed;  // tree thread -> reader
+    bool finished;                  // reader is done; no more buffers
+
+    // tree thread side
+    CommandParser parser;
+    Buffer *current;
+    int nextBuffer;
+
+    std::thread reader;
+    size_t totalBytes;
+    size_t readerStalls;
+    size_t treeStalls;
+
+    void readLoop();
+    bool fill(Buffer &buffer, size_t &lineEnd);
+    bool inputReady() const;
+};
+
+#endif
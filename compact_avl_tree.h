@@ -0,0 +1,657 @@
+#ifndef COMPACT_AVL_TREE_H
+#define COMPACT_AVL_TREE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#ifdef AVL_DEBUG
+#include <cassert>
+#endif
+
+// Compact storage mode for an AVL set.
+// All nodes live in one contiguous vector & link to their children by
+// 32-bit index instead of pointer. The balance factor (-1, 0, +1) is
+// packed into the top 2 bits of the left index, so an int key costs
+// 12 bytes per node. There is no root flag & no parent pointer: every
+// rotation returns the index of the new subtree root & the caller
+// links it in (the tree's root is just another such link).
+template <typename Key, typename Compare = std::less<Key>>
+class CompactAvlTree
+{
+public:
+    // no child / empty tree
+    static const uint32_t NIL = 0x3FFFFFFF;
+    // most nodes a tree can hold (indices use 30 bits)
+    static const uint32_t MAX_NODES = NIL;
+    static const int MAX_DEPTH = 64;
+
+    struct Node
+    {
+        Key key;
+        uint32_t leftAndBalance; // bits 30-31: balance factor + 1
+        uint32_t right;          // also links the free list
+    };
+
+    CompactAvlTree()
+    {
+        root = NIL;
+        freeList = NIL;
+        count = 0;
+    }
+
+    // Remove every key (keeps the vector's memory for reuse)
+    void clear()
+    {
+        nodes.clear();
+        root = NIL;
+        freeList = NIL;
+        count = 0;
+    }
+
+    bool empty() const { return root == NIL; }
+    size_t size() const { return count; }
+    size_t bytesUsed() const { return nodes.capacity() * sizeof(Node); }
+
+    // INSERT
+    // returns false if key was already there
+    bool insert(const Key &key)
+    {
+        bool grew = false;
+        bool inserted = false;
+        root = insertAt(root, key, grew, inserted);
+        debugValidate();
+        return inserted;
+    }
+
+    // DELETE
+    // returns false if key wasn't there
+    bool erase(const Key &key)
+    {
+        bool shrank = false;
+        bool erased = false;
+        root = eraseAt(root, key, shrank, erased);
+        debugValidate();
+        return erased;
+    }
+
+    // SEARCH
+    bool contains(const Key &key) const
+    {
+        uint32_t current = root;
+        while (current != NIL)
+        {
+            const Node &n = nodes[current];
+            if (compare(key, n.key))
+            {
+                current = leftOf(current);
+            }
+            else if (compare(n.key, key))
+            {
+                current = n.right;
+            }
+            else
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Closest key below (or above) key, or key itself if inclusive;
+    // NULL if none. One descent, like contains.
+    const Key *nearest(const Key &key, bool below, bool inclusive) const
+    {
+        uint32_t current = root;
+        const Key *best = NULL;
+        while (current != NIL)
+        {
+            const Node &n = nodes[current];
+            if (compare(key, n.key))
+            {
+                if (!below)
+                {
+                    best = &n.key;
+                }
+                current = leftOf(current);
+            }
+            else if (compare(n.key, key))
+            {
+                if (below)
+                {
+                    best = &n.key;
+                }
+                current = n.right;
+            }
+            else if (inclusive)
+            {
+                return &n.key;
+            }
+            else
+            {
+                current = below ? leftOf(current) : n.right;
+            }
+        }
+        return best;
+    }
+
+    // most lookups containsBatch keeps in flight at once
+    static constexpr size_t BATCH_LANES = 16;
+
+    // Batched lookup: found[i] = contains(keys[i]), with up to
+    // BATCH_LANES descents run in lockstep & each lane's next node
+    // prefetched (same scheme as AvlTree::containsBatch)
+    void containsBatch(const Key *keys, size_t keyCount, bool *found) const
+    {
+        for (size_t base = 0; base < keyCount; base += BATCH_LANES)
+        {
+            size_t lanes = std::min(BATCH_LANES, keyCount - base);
+            uint32_t current[BATCH_LANES];
+            for (size_t i = 0; i < lanes; i++)
+            {
+                current[i] = root;
+                found[base + i] = false;
+            }
+
+            size_t active = lanes;
+            while (active > 0)
+            {
+                active = 0;
+                for (size_t i = 0; i < lanes; i++)
+                {
+                    uint32_t n = current[i];
+                    if (n == NIL)
+                    {
+                        continue;
+                    }
+                    const Key &key = keys[base + i];
+                    if (compare(key, nodes[n].key))
+                    {
+                        n = leftOf(n);
+                    }
+                    else if (compare(nodes[n].key, key))
+                    {
+                        n = nodes[n].right;
+                    }
+                    else
+                    {
+                        found[base + i] = true;
+                        n = NIL;
+                    }
+
+                    if (n != NIL)
+                    {
+                        __builtin_prefetch(&nodes[n]);
+                        active++;
+                    }
+                    current[i] = n;
+                }
+            }
+        }
+    }
+
+    // Cursor for range search, same contract as AvlTree::RangeCursor:
+    // start() is O(log n), each next() amortized O(1)
+    class RangeCursor
+    {
+    public:
+        RangeCursor() : tree(NULL), upper(NULL), depth(0) {}
+
+        void start(const CompactAvlTree &t, const Key &lower, const Key &upperBound)
+        {
+            tree = &t;
+            upper = &upperBound;
+            depth = 0;
+
+            uint32_t n = t.root;
+            while (n != NIL)
+            {
+                if (!t.compare(t.nodes[n].key, lower))
+                {
+                    path[depth++] = n;
+                    n = t.leftOf(n);
+                }
+                else
+                {
+                    n = t.nodes[n].right;
+                }
+            }
+        }
+
+        // start at the smallest key, with no upper bound
+        void startAtMin(const CompactAvlTree &t)
+        {
+            tree = &t;
+            upper = NULL;
+            depth = 0;
+
+            uint32_t n = t.root;
+            while (n != NIL)
+            {
+                path[depth++] = n;
+                n = t.leftOf(n);
+            }
+        }
+
+        const Key *peek() const
+        {
+            if (depth == 0)
+            {
+                return NULL;
+            }
+            const Key &key = tree->nodes[path[depth - 1]].key;
+            if (upper != NULL && tree->compare(*upper, key))
+            {
+                return NULL;
+            }
+            return &key;
+        }
+
+        const Key *next()
+        {
+            const Key *key = peek();
+            if (key == NULL)
+            {
+                return NULL;
+            }
+
+            // next key is the leftmost node of the right subtree
+            uint32_t n = tree->nodes[path[--depth]].right;
+            while (n != NIL)
+            {
+                path[depth++] = n;
+                n = tree->leftOf(n);
+            }
+            return key;
+        }
+
+    private:
+        const CompactAvlTree *tree;
+        const Key *upper; // caller keeps the bound alive while scanning
+        uint32_t path[MAX_DEPTH];
+        int depth;
+    };
+
+    // BULK LOAD
+    // merge a batch of keys with the tree's keys & rebuild it balanced,
+    // laid out in a fresh vector in O(n) (plus the sort)
+    void bulkInsert(std::vector<Key> keys)
+    {
+        std::sort(keys.begin(), keys.end(), compare);
+
+        std::vector<Key> merged;
+        merged.reserve(count + keys.size());
+        RangeCursor cursor;
+        cursor.startAtMin(*this);
+        const Key *existing = cursor.next();
+        size_t j = 0;
+        while (existing != NULL || j < keys.size())
+        {
+            if (j == keys.size() || (existing != NULL && compare(*existing, keys[j])))
+            {
+                merged.push_back(*existing);
+                existing = cursor.next();
+            }
+            else
+            {
+                // skip duplicates within the batch & of existing keys
+                if (merged.empty() || compare(merged.back(), keys[j]))
+                {
+                    if (existing != NULL && !compare(keys[j], *existing))
+                    {
+                        existing = cursor.next();
+                    }
+                    merged.push_back(keys[j]);
+                }
+                j++;
+            }
+        }
+
+        clear();
+        nodes.reserve(merged.size());
+        int height;
+        root = buildBalanced(merged, 0, merged.size(), height);
+        count = merged.size();
+        debugValidate();
+    }
+
+#ifdef AVL_DEBUG
+    // Debug-only checker: recomputes heights from scratch & asserts the
+    // packed balance factors match & keys are in order
+    void validate() const
+    {
+        validateSubtree(root, NULL, NULL);
+    }
+#endif
+
+private:
+    std::vector<Node> nodes;
+    uint32_t root;
+    uint32_t freeList; // deleted slots, linked through right
+    size_t count;
+    Compare compare;
+
+    uint32_t leftOf(uint32_t n) const
+    {
+        return nodes[n].leftAndBalance & NIL;
+    }
+
+    void setLeft(uint32_t n, uint32_t left)
+    {
+        nodes[n].leftAndBalance = (nodes[n].leftAndBalance & ~NIL) | left;
+    }
+
+    // left subtree height minus right subtree height
+    int balanceOf(uint32_t n) const
+    {
+        return (int)(nodes[n].leftAndBalance >> 30) - 1;
+    }
+
+    void setBalance(uint32_t n, int balance)
+    {
+        nodes[n].leftAndBalance = (nodes[n].leftAndBalance & NIL) | ((uint32_t)(balance + 1) << 30);
+    }
+
+    uint32_t createNode(const Key &key)
+    {
+        uint32_t n;
+        if (freeList != NIL)
+        {
+            // reuse a deleted slot
+            n = freeList;
+            freeList = nodes[n].right;
+            nodes[n].key = key;
+        }
+        else
+        {
+            n = (uint32_t)nodes.size();
+            nodes.push_back(Node());
+            nodes[n].key = key;
+        }
+        nodes[n].leftAndBalance = NIL | (1u << 30); // no left child, balanced
+        nodes[n].right = NIL;
+        count++;
+        return n;
+    }
+
+    void freeNode(uint32_t n)
+    {
+        nodes[n].right = freeList;
+        freeList = n;
+        count--;
+    }
+
+    // ROTATIONS
+    // each returns the index of the new subtree root
+
+    // single right rotation (LL); balance factors fixed by the caller
+    uint32_t rotateRight(uint32_t n)
+    {
+        uint32_t leftChild = leftOf(n);
+        setLeft(n, nodes[leftChild].right);
+        nodes[leftChild].right = n;
+        return leftChild;
+    }
+
+    // single left rotation (RR); balance factors fixed by the caller
+    uint32_t rotateLeft(uint32_t n)
+    {
+        uint32_t rightChild = nodes[n].right;
+        nodes[n].right = leftOf(rightChild);
+        setLeft(rightChild, n);
+        return rightChild;
+    }
+
+    // n's left side is 2 higher than its right (n still stores +1).
+    // Fixes it with an LL or LR rotation & returns the new subtree root;
+    // heightDropped tells if the subtree is now 1 lower than at +2.
+    uint32_t fixLeftHeavy(uint32_t n, bool &heightDropped)
+    {
+        uint32_t child = leftOf(n);
+        int childBalance = balanceOf(child);
+
+        if (childBalance >= 0)
+        {
+            // LL imbalance (child balance 0 only happens after a delete)
+            uint32_t top = rotateRight(n);
+            setBalance(n, childBalance == 0 ? 1 : 0);
+            setBalance(top, childBalance == 0 ? -1 : 0);
+            heightDropped = childBalance != 0;
+            return top;
+        }
+
+        // LR imbalance
+        uint32_t grandchild = nodes[child].right;
+        int grandchildBalance = balanceOf(grandchild);
+        setLeft(n, rotateLeft(child));
+        uint32_t top = rotateRight(n);
+        setBalance(n, grandchildBalance == 1 ? -1 : 0);
+        setBalance(child, grandchildBalance == -1 ? 1 : 0);
+        setBalance(top, 0);
+        heightDropped = true;
+        return top;
+    }
+
+    // mirror image of fixLeftHeavy (RR or RL rotation)
+    uint32_t fixRightHeavy(uint32_t n, bool &heightDropped)
+    {
+        uint32_t child = nodes[n].right;
+        int childBalance = balanceOf(child);
+
+        if (childBalance <= 0)
+        {
+            // RR imbalance
+            uint32_t top = rotateLeft(n);
+            setBalance(n, childBalance == 0 ? -1 : 0);
+            setBalance(top, childBalance == 0 ? 1 : 0);
+            heightDropped = childBalance != 0;
+            return top;
+        }
+
+        // RL imbalance
+        uint32_t grandchild = leftOf(child);
+        int grandchildBalance = balanceOf(grandchild);
+        nodes[n].right = rotateRight(child);
+        uint32_t top = rotateLeft(n);
+        setBalance(n, grandchildBalance == -1 ? 1 : 0);
+        setBalance(child, grandchildBalance == 1 ? -1 : 0);
+        setBalance(top, 0);
+        heightDropped = true;
+        return top;
+    }
+
+    // Insert into subtree n; returns its new root.
+    // grew is set if the subtree got taller.
+    uint32_t insertAt(uint32_t n, const Key &key, bool &grew, bool &inserted)
+    {
+        if (n == NIL)
+        {
+            if (count >= MAX_NODES)
+            {
+                // out of indices; leave tree as is
+                return NIL;
+            }
+            grew = true;
+            inserted = true;
+            return createNode(key);
+        }
+
+        if (compare(key, nodes[n].key))
+        {
+            uint32_t left = insertAt(leftOf(n), key, grew, inserted);
+            setLeft(n, left);
+            if (grew)
+            {
+                int balance = balanceOf(n);
+                if (balance == 1)
+                {
+                    // now 2 higher on the left
+                    bool dropped;
+                    grew = false;
+                    return fixLeftHeavy(n, dropped);
+                }
+                setBalance(n, balance + 1);
+                grew = (balance == 0);
+            }
+        }
+        else if (compare(nodes[n].key, key))
+        {
+            uint32_t right = insertAt(nodes[n].right, key, grew, inserted);
+            nodes[n].right = right;
+            if (grew)
+            {
+                int balance = balanceOf(n);
+                if (balance == -1)
+                {
+                    bool dropped;
+                    grew = false;
+                    return fixRightHeavy(n, dropped);
+                }
+                setBalance(n, balance - 1);
+                grew = (balance == 0);
+            }
+        }
+        // else: no duplicates allowed.
+        return n;
+    }
+
+    // Rebalance n after its left subtree got 1 lower; returns new root
+    uint32_t leftShrank(uint32_t n, bool &shrank)
+    {
+        int balance = balanceOf(n);
+        if (balance == -1)
+        {
+            // now 2 higher on the right
+            return fixRightHeavy(n, shrank);
+        }
+        setBalance(n, balance - 1);
+        shrank = (balance == 1);
+        return n;
+    }
+
+    // Rebalance n after its right subtree got 1 lower; returns new root
+    uint32_t rightShrank(uint32_t n, bool &shrank)
+    {
+        int balance = balanceOf(n);
+        if (balance == 1)
+        {
+            return fixLeftHeavy(n, shrank);
+        }
+        setBalance(n, balance + 1);
+        shrank = (balance == -1);
+        return n;
+    }
+
+    // Unlink the min node of subtree n into minNode; returns new root
+    uint32_t removeMin(uint32_t n, uint32_t &minNode, bool &shrank)
+    {
+        uint32_t left = leftOf(n);
+        if (left == NIL)
+        {
+            minNode = n;
+            shrank = true;
+            return nodes[n].right;
+        }
+        setLeft(n, removeMin(left, minNode, shrank));
+        if (shrank)
+        {
+            return leftShrank(n, shrank);
+        }
+        return n;
+    }
+
+    // Delete from subtree n; returns its new root.
+    // shrank is set if the subtree got lower.
+    uint32_t eraseAt(uint32_t n, const Key &key, bool &shrank, bool &erased)
+    {
+        if (n == NIL)
+        {
+            shrank = false;
+            return NIL;
+        }
+
+        if (compare(key, nodes[n].key))
+        {
+            setLeft(n, eraseAt(leftOf(n), key, shrank, erased));
+            return shrank ? leftShrank(n, shrank) : n;
+        }
+        if (compare(nodes[n].key, key))
+        {
+            nodes[n].right = eraseAt(nodes[n].right, key, shrank, erased);
+            return shrank ? rightShrank(n, shrank) : n;
+        }
+
+        // found it
+        erased = true;
+        uint32_t left = leftOf(n);
+        uint32_t right = nodes[n].right;
+
+        if (left == NIL || right == NIL)
+        {
+            // 0 or 1 child: child takes n's place
+            freeNode(n);
+            shrank = true;
+            return left == NIL ? right : left;
+        }
+
+        // 2 children: the min of the right subtree takes n's place
+        uint32_t successor;
+        right = removeMin(right, successor, shrank);
+        setLeft(successor, left);
+        nodes[successor].right = right;
+        setBalance(successor, balanceOf(n));
+        freeNode(n);
+        return shrank ? rightShrank(successor, shrank) : successor;
+    }
+
+    // Helper function for bulk load
+    // Lays sorted keys[lo, hi) out as a perfectly balanced subtree
+    uint32_t buildBalanced(const std::vector<Key> &keys, size_t lo, size_t hi, int &height)
+    {
+        if (lo >= hi)
+        {
+            height = 0;
+            return NIL;
+        }
+        size_t mid = lo + (hi - lo) / 2;
+        int leftHeight;
+        int rightHeight;
+        uint32_t left = buildBalanced(keys, lo, mid, leftHeight);
+        uint32_t n = (uint32_t)nodes.size();
+        nodes.push_back(Node());
+        nodes[n].key = keys[mid];
+        uint32_t right = buildBalanced(keys, mid + 1, hi, rightHeight);
+
+        nodes[n].leftAndBalance = left;
+        nodes[n].right = right;
+        setBalance(n, leftHeight - rightHeight);
+        height = std::max(leftHeight, rightHeight) + 1;
+        return n;
+    }
+
+    void debugValidate() const
+    {
+#ifdef AVL_DEBUG
+        validate();
+#endif
+    }
+
+#ifdef AVL_DEBUG
+    int validateSubtree(uint32_t n, const Key *low, const Key *high) const
+    {
+        if (n == NIL)
+        {
+            return 0;
+        }
+        assert(low == NULL || compare(*low, nodes[n].key));
+        assert(high == NULL || compare(nodes[n].key, *high));
+        int leftHeight = validateSubtree(leftOf(n), low, &nodes[n].key);
+        int rightHeight = validateSubtree(nodes[n].right, &nodes[n].key, high);
+        assert(balanceOf(n) == leftHeight - rightHeight);
+        return std::max(leftHeight, rightHeight) + 1;
+    }
+#endif
+};
+
+#endif
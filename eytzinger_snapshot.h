@@ -0,0 +1,143 @@
+#ifndef EYTZINGER_SNAPSHOT_H
+#define EYTZINGER_SNAPSHOT_H
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+// Read-only snapshot of a sorted key set in Eytzinger (BFS) order:
+// the root is at index 1 and the children of i are at 2i & 2i + 1.
+// A search touches one array slot per level with no pointer chasing,
+// the top levels stay hot in cache, and the slots a search needs 4
+// levels down are contiguous, so they are prefetched ahead of time.
+template <typename Key, typename Compare = std::less<Key>>
+class EytzingerSnapshot
+{
+public:
+    EytzingerSnapshot() : count(0) {}
+
+    // Lay out sorted, duplicate-free keys
+    void build(const std::vector<Key> &sorted)
+    {
+        count = sorted.size();
+        slots.assign(count + 1, Key());
+        size_t next = 0;
+        place(sorted, next, 1);
+    }
+
+    void clear()
+    {
+        slots.clear();
+        count = 0;
+    }
+
+    bool empty() const { return count == 0; }
+    size_t size() const { return count; }
+    size_t bytesUsed() const { return slots.capacity() * sizeof(Key); }
+
+    bool contains(const Key &key) const
+    {
+        size_t k = lowerBound(key);
+        return k != 0 && !compare(key, slots[k]);
+    }
+
+    // Cursor for range search, same contract as AvlTree::RangeCursor.
+    // Moving to the in-order successor is index arithmetic, amortized O(1).
+    class RangeCursor
+    {
+    public:
+        RangeCursor() : snapshot(NULL), upper(NULL), k(0) {}
+
+        void start(const EytzingerSnapshot &s, const Key &lower, const Key &upperBound)
+        {
+            snapshot = &s;
+            upper = &upperBound;
+            k = s.lowerBound(lower);
+        }
+
+        const Key *peek() const
+        {
+            if (k == 0 || snapshot->compare(*upper, snapshot->slots[k]))
+            {
+                return NULL;
+            }
+            return &snapshot->slots[k];
+        }
+
+        const Key *next()
+        {
+            const Key *key = peek();
+            if (key != NULL)
+            {
+                k = snapshot->successor(k);
+            }
+            return key;
+        }
+
+    private:
+        const EytzingerSnapshot *snapshot;
+        const Key *upper; // caller keeps the bound alive while scanning
+        size_t k;         // 0 once past the largest key
+    };
+
+private:
+    // slots[0] is unused so the index math stays simple
+    std::vector<Key> slots;
+    size_t count;
+    Compare compare;
+
+    // keys per cache line; a search prefetches the line holding the
+    // first descendant 4 levels down (16 slots wide for 4-byte keys)
+    static const size_t KEYS_PER_LINE = sizeof(Key) >= 64 ? 1 : 64 / sizeof(Key);
+
+    // in-order walk of the implicit tree, filling it from sorted
+    void place(const std::vector<Key> &sorted, size_t &next, size_t k)
+    {
+        if (k > count)
+        {
+            return;
+        }
+        place(sorted, next, 2 * k);
+        slots[k] = sorted[next++];
+        place(sorted, next, 2 * k + 1);
+    }
+
+    // Index of the first key >= key, or 0 if there is none
+    size_t lowerBound(const Key &key) const
+    {
+        size_t k = 1;
+        while (k <= count)
+        {
+            __builtin_prefetch(slots.data() + (k * KEYS_PER_LINE < count ? k * KEYS_PER_LINE : 0));
+            // branch free: go right iff slot < key
+            k = 2 * k + compare(slots[k], key);
+        }
+        // undo the trailing right turns, plus the last left turn;
+        // where the last left turn was taken is the answer
+        k >>= __builtin_ctzll(~(unsigned long long)k) + 1;
+        return k;
+    }
+
+    // Index of the next key in order, or 0 after the largest
+    size_t successor(size_t k) const
+    {
+        if (2 * k + 1 <= count)
+        {
+            // leftmost slot of the right subtree
+            k = 2 * k + 1;
+            while (2 * k <= count)
+            {
+                k = 2 * k;
+            }
+            return k;
+        }
+        // climb while coming from a right child, then one more step
+        while (k & 1)
+        {
+            k >>= 1;
+        }
+        return k >> 1;
+    }
+};
+
+#endif
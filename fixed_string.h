@@ -0,0 +1,118 @@
+#ifndef FIXED_STRING_H
+#define FIXED_STRING_H
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+// Fixed-width string key: up to N chars stored inline (zero padded),
+// so it can live directly in a tree node & compares with one memcmp
+template <size_t N>
+struct FixedString
+{
+    char chars[N];
+
+    FixedString()
+    {
+        memset(chars, 0, N);
+    }
+
+    // longer strings are cut off at N chars
+    FixedString(const char *text, size_t length)
+    {
+        assign(text, length);
+    }
+
+    FixedString(const char *text)
+    {
+        assign(text, strlen(text));
+    }
+
+    FixedString(const std::string &text)
+    {
+        assign(text.data(), text.size());
+    }
+
+    size_t length() const
+    {
+        const void *zero = memchr(chars, 0, N);
+        return zero == NULL ? N : static_cast<const char *>(zero) - chars;
+    }
+
+    std::string str() const
+    {
+        return std::string(chars, length());
+    }
+
+    bool operator<(const FixedString &other) const
+    {
+        return memcmp(chars, other.chars, N) < 0;
+    }
+
+private:
+    void assign(const char *text, size_t length)
+    {
+        if (length > N)
+        {
+            length = N;
+        }
+        memcpy(chars, text, length);
+        memset(chars + length, 0, N - length);
+    }
+};
+
+// Transparent comparator: lets a tree of FixedString<N> keys be
+// searched with a const char* or std::string, without building a key
+template <size_t N>
+struct FixedStringLess
+{
+    typedef void is_transparent;
+
+    bool operator()(const FixedString<N> &a, const FixedString<N> &b) const
+    {
+        return a < b;
+    }
+
+    bool operator()(const FixedString<N> &a, const std::string &b) const
+    {
+        return compare(a, b.data(), b.size()) < 0;
+    }
+
+    bool operator()(const std::string &a, const FixedString<N> &b) const
+    {
+        return compare(b, a.data(), a.size()) > 0;
+    }
+
+    bool operator()(const FixedString<N> &a, const char *b) const
+    {
+        return compare(a, b, strlen(b)) < 0;
+    }
+
+    bool operator()(const char *a, const FixedString<N> &b) const
+    {
+        return compare(b, a, strlen(a)) > 0;
+    }
+
+private:
+    // compare key against text as if text were zero padded to N chars
+    static int compare(const FixedString<N> &key, const char *text, size_t length)
+    {
+        size_t common = length < N ? length : N;
+        int result = memcmp(key.chars, text, common);
+        if (result != 0)
+        {
+            return result;
+        }
+        // rest of key vs zero padding (or the rest of a too long text)
+        for (size_t i = common; i < N; i++)
+        {
+            if (key.chars[i] != 0)
+            {
+                return 1;
+            }
+        }
+        return 0;
+    }
+};
+
+#endif
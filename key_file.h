@@ -0,0 +1,326 @@
+#ifndef KEY_FILE_H
+#define KEY_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Binary snapshot of a tree's keys (Save/Load):
+//
+//   KeyFileHeader, then count keys in strictly increasing order,
+//   then (layout 1 only) count values, one per key in the same order
+//
+// Keys & values are stored raw (so both must be trivially copyable, and
+// a Value mustn't need more alignment than a Key), and the checksum
+// covers everything after the header. Sorted keys are all a balanced tree needs:
+// loading rebuilds it in O(n) with no comparisons or rotations.
+
+// bump when the layout changes; older files are rejected
+const uint32_t KEY_FILE_VERSION = 1;
+
+struct KeyFileHeader
+{
+    char magic[8]; // "AVLKEYS\0"
+    uint32_t version;
+    uint32_t keyBytes; // sizeof(Key) of the writer
+    uint64_t count;
+    uint64_t checksum;
+    uint32_t layout;     // 0 = sorted keys; 1 = sorted keys, then values
+    uint32_t valueBytes; // sizeof(Value) of the writer (layout 1)
+};
+
+static const char KEY_FILE_MAGIC[8] = {'A', 'V', 'L', 'K', 'E', 'Y', 'S', '\0'};
+
+// Running checksum over raw key bytes, 8 bytes at a time (FNV-1a style)
+class KeyChecksum
+{
+public:
+    KeyChecksum() : hash(14695981039346656037ULL) {}
+
+    void add(const void *bytes, size_t length)
+    {
+        const unsigned char *p = static_cast<const unsigned char *>(bytes);
+        while (length >= 8)
+        {
+            uint64_t word;
+            memcpy(&word, p, 8);
+            hash = (hash ^ word) * 1099511628211ULL;
+            p += 8;
+            length -= 8;
+        }
+        while (length > 0)
+        {
+            hash = (hash ^ *p++) * 1099511628211ULL;
+            length--;
+        }
+    }
+
+    uint64_t value() const { return hash; }
+
+private:
+    uint64_t hash;
+};
+
+// Writes a key file. Keys go to "<path>.tmp", which only replaces path
+// once commit() has written everything, so a failed Save never leaves
+// a half written snapshot behind. For a file with values, append every
+// key first, then every value.
+template <typename Key>
+class KeyFileWriter
+{
+public:
+    KeyFileWriter() : fd(-1), count(0), valueCount(0), valueBytes(0), buffer(BUFFER_BYTES), used(0), failed(false) {}
+
+    ~KeyFileWriter()
+    {
+        if (fd >= 0)
+        {
+            // never committed
+            ::close(fd);
+            unlink(tempPath.c_str());
+        }
+    }
+
+    KeyFileWriter(const KeyFileWriter &) = delete;
+    KeyFileWriter &operator=(const KeyFileWriter &) = delete;
+
+    bool open(const std::string &fileName)
+    {
+        path = fileName;
+        tempPath = fileName + ".tmp";
+        fd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            return false;
+        }
+        // header is written last, once count & checksum are known
+        KeyFileHeader blank = KeyFileHeader();
+        return writeAll(&blank, sizeof(blank));
+    }
+
+    // keys must come in strictly increasing order
+    void append(const Key &key)
+    {
+        put(&key, sizeof(Key));
+        count++;
+    }
+
+    // value of the next key (in append order), once all keys are in
+    template <typename Value>
+    void appendValue(const Value &value)
+    {
+        put(&value, sizeof(Value));
+        valueBytes = sizeof(Value);
+        valueCount++;
+    }
+
+    // Finish the file & move it into place; returns false on any error
+    bool commit()
+    {
+        flushBuffer();
+
+        KeyFileHeader header = KeyFileHeader();
+        memcpy(header.magic, KEY_FILE_MAGIC, sizeof(header.magic));
+        header.version = KEY_FILE_VERSION;
+        header.keyBytes = sizeof(Key);
+        header.count = count;
+        header.checksum = checksum.value();
+        header.layout = valueCount > 0 ? 1 : 0;
+        header.valueBytes = valueBytes;
+
+        bool ok = !failed && (valueCount == 0 || valueCount == count) && pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+        ok = fsync(fd) == 0 && ok;
+        ok = ::close(fd) == 0 && ok;
+        fd = -1;
+        if (!ok || rename(tempPath.c_str(), path.c_str()) != 0)
+        {
+            unlink(tempPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static const size_t BUFFER_BYTES = 1 << 20;
+    // every flush but the last is exactly CHUNK_BYTES (whole checksum
+    // words, keys & values may straddle two chunks), so the checksum
+    // comes out the same as over the file in one go
+    static const size_t CHUNK_BYTES = BUFFER_BYTES;
+
+    std::string path;
+    std::string tempPath;
+    int fd;
+    uint64_t count;
+    uint64_t valueCount;
+    uint32_t valueBytes;
+    KeyChecksum checksum;
+    std::vector<char> buffer;
+    size_t used;
+    bool failed;
+
+    void put(const void *bytes, size_t length)
+    {
+        const char *p = static_cast<const char *>(bytes);
+        while (length > 0)
+        {
+            size_t room = CHUNK_BYTES - used;
+            size_t n = length < room ? length : room;
+            memcpy(buffer.data() + used, p, n);
+            used += n;
+            p += n;
+            length -= n;
+            if (used == CHUNK_BYTES)
+            {
+                flushBuffer();
+            }
+        }
+    }
+
+    void flushBuffer()
+    {
+        checksum.add(buffer.data(), used);
+        if (!writeAll(buffer.data(), used))
+        {
+            failed = true;
+        }
+        used = 0;
+    }
+
+    bool writeAll(const void *data, size_t length)
+    {
+        const char *p = static_cast<const char *>(data);
+        while (length > 0)
+        {
+            ssize_t written = write(fd, p, length);
+            if (written <= 0)
+            {
+                return false;
+            }
+            p += written;
+            length -= written;
+        }
+        return true;
+    }
+};
+
+// Maps a key file & checks it; keys() (& values()) then point straight
+// into the mapping (valid until close), so nothing is copied or parsed
+template <typename Key>
+class KeyFileReader
+{
+public:
+    KeyFileReader() : data(NULL), length(0), keyCount(0), reason("not open") {}
+    ~KeyFileReader() { close(); }
+
+    KeyFileReader(const KeyFileReader &) = delete;
+    KeyFileReader &operator=(const KeyFileReader &) = delete;
+
+    // Returns false (see error()) if the file can't be read or is damaged
+    bool open(const std::string &fileName)
+    {
+        close();
+        int fd = ::open(fileName.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return fail("can't open file");
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(KeyFileHeader))
+        {
+            ::close(fd);
+            return fail("too short for a header");
+        }
+        length = info.st_size;
+
+        void *mapped = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED)
+        {
+            length = 0;
+            return fail("can't map file");
+        }
+        data = static_cast<const char *>(mapped);
+        // read front to back once
+        madvise(mapped, length, MADV_SEQUENTIAL);
+
+        const KeyFileHeader *header = reinterpret_cast<const KeyFileHeader *>(data);
+        if (memcmp(header->magic, KEY_FILE_MAGIC, sizeof(header->magic)) != 0)
+        {
+            return fail("not a key file");
+        }
+        if (header->version != KEY_FILE_VERSION || header->layout > 1)
+        {
+            return fail("unsupported version");
+        }
+        size_t entryBytes = sizeof(Key) + (header->layout == 1 ? header->valueBytes : 0);
+        if (header->keyBytes != sizeof(Key) ||
+            header->count != (length - sizeof(KeyFileHeader)) / entryBytes ||
+            (length - sizeof(KeyFileHeader)) % entryBytes != 0)
+        {
+            return fail("size doesn't match header");
+        }
+
+        KeyChecksum checksum;
+        checksum.add(data + sizeof(KeyFileHeader), length - sizeof(KeyFileHeader));
+        if (checksum.value() != header->checksum)
+        {
+            return fail("checksum mismatch");
+        }
+        keyCount = header->count;
+        reason = NULL;
+        return true;
+    }
+
+    void close()
+    {
+        if (data != NULL)
+        {
+            munmap(const_cast<char *>(data), length);
+            data = NULL;
+            length = 0;
+        }
+        keyCount = 0;
+        reason = "not open";
+    }
+
+    const Key *keys() const { return reinterpret_cast<const Key *>(data + sizeof(KeyFileHeader)); }
+    size_t count() const { return keyCount; }
+
+    // the value of each key, or NULL if the file has none (or they
+    // aren't Values)
+    template <typename Value>
+    const Value *values() const
+    {
+        const KeyFileHeader *header = reinterpret_cast<const KeyFileHeader *>(data);
+        if (data == NULL || header->layout != 1 || header->valueBytes != sizeof(Value))
+        {
+            return NULL;
+        }
+        return reinterpret_cast<const Value *>(data + sizeof(KeyFileHeader) + keyCount * sizeof(Key));
+    }
+
+    // why open() failed
+    const char *error() const { return reason; }
+
+private:
+    const char *data;
+    size_t length;
+    size_t keyCount;
+    const char *reason;
+
+    bool fail(const char *why)
+    {
+        close();
+        reason = why;
+        return false;
+    }
+};
+
+#endif
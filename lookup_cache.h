@@ -0,0 +1,145 @@
+#ifndef LOOKUP_CACHE_H
+#define LOOKUP_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Small 2-way set-associative cache from search keys to what a lookup
+// found: a node handle, or a null handle for "not there".
+// Keys map to a set by (multiplicative) hash; a hit marks its way as
+// most recently used, and a store after a miss replaces the other way.
+// The owner keeps it exact by invalidating a key whenever the answer
+// for it changes (see AvlTree::enableCache).
+template <typename Key, typename Handle>
+class LookupCache
+{
+public:
+    static const size_t WAYS = 2;
+
+    LookupCache() : shift(0), hitCount(0), missCount(0) {}
+
+    // Make room for about entries keys (rounded up to a power of 2,
+    // at least 4); 0 turns the cache off. Drops every entry.
+    void resize(size_t entries)
+    {
+        slots.clear();
+        lastUsed.clear();
+        if (entries == 0)
+        {
+            return;
+        }
+        size_t sets = 2;
+        int bits = 1;
+        while (sets * WAYS < entries)
+        {
+            sets *= 2;
+            bits++;
+        }
+        slots.assign(sets * WAYS, Entry());
+        lastUsed.assign(sets, 0);
+        shift = 64 - bits;
+    }
+
+    bool enabled() const { return !slots.empty(); }
+    size_t capacity() const { return slots.size(); }
+
+    size_t hits() const { return hitCount; }
+    size_t misses() const { return missCount; }
+
+    // Returns true (& sets handle) if key is cached
+    template <typename Equal>
+    bool lookup(const Key &key, Handle &handle, Equal equal)
+    {
+        size_t set = setOf(key);
+        Entry *ways = &slots[set * WAYS];
+        for (size_t w = 0; w < WAYS; w++)
+        {
+            if (ways[w].valid && equal(ways[w].key, key))
+            {
+                handle = ways[w].handle;
+                lastUsed[set] = (unsigned char)w;
+                hitCount++;
+                return true;
+            }
+        }
+        missCount++;
+        return false;
+    }
+
+    // Remember the answer for key (after a miss), evicting the way of
+    // its set that wasn't used last
+    void store(const Key &key, Handle handle)
+    {
+        size_t set = setOf(key);
+        size_t w = lastUsed[set] ^ 1;
+        Entry &entry = slots[set * WAYS + w];
+        entry.key = key;
+        entry.handle = handle;
+        entry.valid = true;
+        lastUsed[set] = (unsigned char)w;
+    }
+
+    // Forget key, if it's cached
+    template <typename Equal>
+    void invalidate(const Key &key, Equal equal)
+    {
+        Entry *ways = &slots[setOf(key) * WAYS];
+        for (size_t w = 0; w < WAYS; w++)
+        {
+            if (ways[w].valid && equal(ways[w].key, key))
+            {
+                ways[w].valid = false;
+            }
+        }
+    }
+
+    // Call visit(key, handle) for every cached key (for checking)
+    template <typename Visit>
+    void forEach(Visit visit) const
+    {
+        for (size_t i = 0; i < slots.size(); i++)
+        {
+            if (slots[i].valid)
+            {
+                visit(slots[i].key, slots[i].handle);
+            }
+        }
+    }
+
+    // Forget every key (the counters are kept)
+    void clear()
+    {
+        for (size_t i = 0; i < slots.size(); i++)
+        {
+            slots[i].valid = false;
+        }
+    }
+
+private:
+    struct Entry
+    {
+        Key key;
+        Handle handle;
+        bool valid;
+
+        Entry() : key(), handle(), valid(false) {}
+    };
+
+    std::vector<Entry> slots;            // WAYS entries per set
+    std::vector<unsigned char> lastUsed; // per set, the way hit or filled last
+    int shift;                           // keeps the top bits of the hash
+    size_t hitCount;
+    size_t missCount;
+
+    size_t setOf(const Key &key) const
+    {
+        // std::hash of an int is the int itself; the multiply spreads
+        // its bits so nearby keys land in different sets
+        uint64_t h = (uint64_t)std::hash<Key>()(key) * 0x9E3779B97F4A7C15ULL;
+        return (size_t)(h >> shift);
+    }
+};
+
+#endif
@@ -0,0 +1,241 @@
+#include "output.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+OutputChannel results;
+OutputChannel trace;
+
+// the two places output can end up
+static WriteBuffer terminalBuffer;
+static WriteBuffer fileBuffer;
+
+WriteBuffer::WriteBuffer()
+{
+    fd = -1;
+    ownsFd = false;
+    block = new char[BLOCK_BYTES];
+    used = 0;
+}
+
+WriteBuffer::~WriteBuffer()
+{
+    close();
+    delete[] block;
+}
+
+void WriteBuffer::attach(int newFd)
+{
+    close();
+    fd = newFd;
+    ownsFd = false;
+}
+
+bool WriteBuffer::open(const string &fileName)
+{
+    close();
+    fd = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ownsFd = true;
+    return fd >= 0;
+}
+
+void WriteBuffer::close()
+{
+    flush();
+    if (ownsFd && fd >= 0)
+    {
+        ::close(fd);
+    }
+    fd = -1;
+    ownsFd = false;
+}
+
+void WriteBuffer::flush()
+{
+    if (used > 0)
+    {
+        writeAll(block, used);
+        used = 0;
+    }
+}
+
+// write() may take less than asked for (pipes, signals); keep going
+void WriteBuffer::writeAll(const char *text, size_t length)
+{
+    if (fd < 0)
+    {
+        return;
+    }
+    while (length > 0)
+    {
+        ssize_t written = ::write(fd, text, length);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            // nowhere to report a failed write; drop the output
+            return;
+        }
+        text += written;
+        length -= written;
+    }
+}
+
+OutputChannel::OutputChannel()
+{
+    terminal = NULL;
+    file = NULL;
+}
+
+void OutputChannel::setTargets(WriteBuffer *newTerminal, WriteBuffer *newFile)
+{
+    terminal = newTerminal;
+    file = newFile;
+}
+
+void OutputChannel::write(const char *text, size_t length)
+{
+    if (terminal != NULL)
+    {
+        terminal->append(text, length);
+    }
+    if (file != NULL)
+    {
+        file->append(text, length);
+    }
+}
+
+OutputChannel &OutputChannel::operator<<(const char *text)
+{
+    if (enabled())
+    {
+        size_t length = 0;
+        while (text[length] != '\0')
+        {
+            length++;
+        }
+        write(text, length);
+    }
+    return *this;
+}
+
+OutputChannel &OutputChannel::operator<<(const string &text)
+{
+    if (enabled())
+    {
+        write(text.data(), text.size());
+    }
+    return *this;
+}
+
+OutputChannel &OutputChannel::operator<<(char c)
+{
+    if (enabled())
+    {
+        write(&c, 1);
+    }
+    return *this;
+}
+
+// Integers are formatted by hand, right to left into a small buffer
+OutputChannel &OutputChannel::operator<<(unsigned long long value)
+{
+    if (enabled())
+    {
+        char digits[24];
+        char *p = digits + sizeof(digits);
+        do
+        {
+            *--p = '0' + (value % 10);
+            value /= 10;
+        } while (value != 0);
+        write(p, digits + sizeof(digits) - p);
+    }
+    return *this;
+}
+
+OutputChannel &OutputChannel::operator<<(long long value)
+{
+    if (enabled())
+    {
+        if (value < 0)
+        {
+            write("-", 1);
+            // negate as unsigned so the minimum value doesn't overflow
+            return *this << (0ULL - (unsigned long long)value);
+        }
+        *this << (unsigned long long)value;
+    }
+    return *this;
+}
+
+OutputChannel &OutputChannel::operator<<(int value)
+{
+    return *this << (long long)value;
+}
+
+OutputChannel &OutputChannel::operator<<(long value)
+{
+    return *this << (long long)value;
+}
+
+OutputChannel &OutputChannel::operator<<(unsigned int value)
+{
+    return *this << (unsigned long long)value;
+}
+
+OutputChannel &OutputChannel::operator<<(unsigned long value)
+{
+    return *this << (unsigned long long)value;
+}
+
+OutputChannel &OutputChannel::operator<<(double value)
+{
+    if (enabled())
+    {
+        char text[32];
+        int length = snprintf(text, sizeof(text), "%g", value);
+        write(text, length);
+    }
+    return *this;
+}
+
+bool outputOpen(const string &fileName, Verbosity verbosity, bool fileOnly)
+{
+    if (verbosity == VERBOSITY_SILENT)
+    {
+        results.setTargets(NULL, NULL);
+        trace.setTargets(NULL, NULL);
+        return true;
+    }
+
+    terminalBuffer.attach(STDOUT_FILENO);
+    if (!fileBuffer.open(fileName))
+    {
+        return false;
+    }
+
+    results.setTargets(fileOnly ? NULL : &terminalBuffer, &fileBuffer);
+    trace.setTargets(verbosity == VERBOSITY_TRACE ? &terminalBuffer : NULL, NULL);
+    return true;
+}
+
+void outputFlush()
+{
+    terminalBuffer.flush();
+    fileBuffer.flush();
+}
+
+void outputClose()
+{
+    results.setTargets(NULL, NULL);
+    trace.setTargets(NULL, NULL);
+    terminalBuffer.close();
+    fileBuffer.close();
+}
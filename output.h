@@ -0,0 +1,109 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <cstddef>
+#include <string>
+
+// how much goes to the terminal
+enum Verbosity
+{
+    VERBOSITY_SILENT,  // nothing at all (not even output.txt)
+    VERBOSITY_RESULTS, // results only (default)
+    VERBOSITY_TRACE    // results, plus progress & rebalancing traces
+};
+
+// Collects output in a large block and hands it to the OS with a
+// single write() whenever the block fills up (or on flush)
+class WriteBuffer
+{
+public:
+    static const size_t BLOCK_BYTES = 1 << 20;
+
+    WriteBuffer();
+    ~WriteBuffer();
+
+    // Write to an already open file descriptor
+    void attach(int fd);
+    // Create/truncate a file & write to it; returns false on failure
+    bool open(const std::string &fileName);
+    void close();
+
+    bool isOpen() const { return fd >= 0; }
+
+    void append(const char *text, size_t length)
+    {
+        if (used + length > BLOCK_BYTES)
+        {
+            flush();
+            if (length > BLOCK_BYTES)
+            {
+                writeAll(text, length);
+                return;
+            }
+        }
+        for (size_t i = 0; i < length; i++)
+        {
+            block[used + i] = text[i];
+        }
+        used += length;
+    }
+
+    void flush();
+
+private:
+    int fd;
+    bool ownsFd;
+    char *block;
+    size_t used;
+
+    void writeAll(const char *text, size_t length);
+};
+
+// One kind of output (results or trace), fanned out to the terminal
+// and/or the output file. Used like a stream:
+//     results << key << "\n";
+// Writes to a disabled channel cost one branch.
+class OutputChannel
+{
+public:
+    OutputChannel();
+
+    void setTargets(WriteBuffer *terminal, WriteBuffer *file);
+    bool enabled() const { return terminal != NULL || file != NULL; }
+
+    OutputChannel &operator<<(const char *text);
+    OutputChannel &operator<<(const std::string &text);
+    OutputChannel &operator<<(char c);
+    OutputChannel &operator<<(int value);
+    OutputChannel &operator<<(long value);
+    OutputChannel &operator<<(long long value);
+    OutputChannel &operator<<(unsigned int value);
+    OutputChannel &operator<<(unsigned long value);
+    OutputChannel &operator<<(unsigned long long value);
+    OutputChannel &operator<<(double value);
+
+private:
+    WriteBuffer *terminal;
+    WriteBuffer *file;
+
+    void write(const char *text, size_t length);
+};
+
+// query results (search hits, counts, stats)
+extern OutputChannel results;
+// progress messages & rebalancing traces; off unless VERBOSITY_TRACE
+extern OutputChannel trace;
+
+// Set up the channels. Results go to the output file & (unless
+// fileOnly) the terminal; traces only ever go to the terminal.
+// Returns false if the output file can't be created.
+bool outputOpen(const std::string &fileName, Verbosity verbosity, bool fileOnly);
+
+// Hand everything buffered so far to the OS (e.g. while the input
+// stream is idle, so results don't wait for more commands)
+void outputFlush();
+
+// Flush everything still buffered & close the output file
+void outputClose();
+
+#endif
@@ -0,0 +1,673 @@
+#ifndef PERSISTENT_AVL_TREE_H
+#define PERSISTENT_AVL_TREE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+#ifdef AVL_DEBUG
+#include <cassert>
+#endif
+#include "slab_pool.h"
+
+// Copy-on-write (persistent) AVL set for concurrent readers.
+//
+// Writers never modify a node that a reader might see: an Insert or
+// Delete copies the O(log n) nodes on its path (plus any it rotates),
+// builds the new version off to the side, and publishes its root with
+// one atomic store. Readers pin a version & search it without locks.
+//
+// Replaced nodes are reclaimed with epoch-based reclamation: each
+// write tags the nodes it replaced with the global epoch & bumps it,
+// readers record the epoch they pinned at, and a batch is freed once
+// every pinned reader started after it was retired.
+//
+// Writes are serialized by an internal mutex; only the writer allocates
+// & frees nodes, so the (single-threaded) SlabPool is safe here.
+template <typename Key, typename Compare = std::less<Key>>
+class PersistentAvlTree
+{
+public:
+    // most reader threads that can be registered at once
+    static const int MAX_READERS = 64;
+    static const int MAX_DEPTH = 96;
+
+    struct Node
+    {
+        Key key;
+        Node *left;
+        Node *right;
+        int height;
+        unsigned int size;
+        uint64_t writeId; // write that created this node; 64 bits so it never wraps
+    };
+
+    PersistentAvlTree()
+    {
+        root.store(NULL);
+        globalEpoch.store(1);
+        writeId = 0;
+    }
+
+    // no readers may be active by now
+    ~PersistentAvlTree()
+    {
+        freeSubtree(root.load());
+        for (size_t i = 0; i < retired.size(); i++)
+        {
+            freeBatch(retired[i]);
+        }
+    }
+
+    PersistentAvlTree(const PersistentAvlTree &) = delete;
+    PersistentAvlTree &operator=(const PersistentAvlTree &) = delete;
+
+    // READERS
+
+    class RangeCursor;
+
+    // Claim a reader slot for the calling thread; returns -1 if all are taken
+    int registerReader()
+    {
+        for (int i = 0; i < MAX_READERS; i++)
+        {
+            bool expected = false;
+            if (readers[i].inUse.compare_exchange_strong(expected, true))
+            {
+                readers[i].epoch.store(0);
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    void unregisterReader(int slot)
+    {
+        readers[slot].epoch.store(0);
+        readers[slot].inUse.store(false);
+    }
+
+    // A pinned version of the tree. Everything reachable from it stays
+    // allocated until the guard is destroyed; reads need no locks.
+    class ReadGuard
+    {
+    public:
+        typedef typename PersistentAvlTree::RangeCursor RangeCursor;
+
+        ReadGuard(const PersistentAvlTree &t, int readerSlot) : tree(t), slot(readerSlot)
+        {
+            // publish our epoch before looking at the root, so a writer
+            // that replaces this root can't free it from under us
+            tree.readers[slot].epoch.store(tree.globalEpoch.load());
+            root = tree.root.load();
+        }
+
+        ~ReadGuard()
+        {
+            tree.readers[slot].epoch.store(0, std::memory_order_release);
+        }
+
+        ReadGuard(const ReadGuard &) = delete;
+        ReadGuard &operator=(const ReadGuard &) = delete;
+
+        bool empty() const { return root == NULL; }
+        size_t size() const { return getSize(root); }
+        int height() const { return root != NULL ? root->height : 0; }
+
+        bool contains(const Key &key) const
+        {
+            const Node *current = root;
+            while (current != NULL)
+            {
+                if (tree.compare(key, current->key))
+                {
+                    current = current->left;
+                }
+                else if (tree.compare(current->key, key))
+                {
+                    current = current->right;
+                }
+                else
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Number of keys < key (or <= key if inclusive)
+        size_t countBelow(const Key &key, bool inclusive) const
+        {
+            const Node *current = root;
+            size_t count = 0;
+            while (current != NULL)
+            {
+                if (tree.compare(current->key, key) || (inclusive && !tree.compare(key, current->key)))
+                {
+                    count += getSize(current->left) + 1;
+                    current = current->right;
+                }
+                else
+                {
+                    current = current->left;
+                }
+            }
+            return count;
+        }
+
+        // k-th smallest key (k = 1 is the minimum), or NULL
+        const Key *select(size_t k) const
+        {
+            if (k < 1 || k > size())
+            {
+                return NULL;
+            }
+            const Node *current = root;
+            while (true)
+            {
+                size_t leftSize = getSize(current->left);
+                if (k <= leftSize)
+                {
+                    current = current->left;
+                }
+                else if (k == leftSize + 1)
+                {
+                    return &current->key;
+                }
+                else
+                {
+                    k -= leftSize + 1;
+                    current = current->right;
+                }
+            }
+        }
+
+    private:
+        friend class PersistentAvlTree;
+        const PersistentAvlTree &tree;
+        int slot;
+        const Node *root;
+    };
+
+    // Cursor for range search over a pinned version,
+    // same contract as AvlTree::RangeCursor
+    class RangeCursor
+    {
+    public:
+        RangeCursor() : tree(NULL), upper(NULL), depth(0) {}
+
+        void start(const ReadGuard &guard, const Key &lower, const Key &upperBound)
+        {
+            tree = &guard.tree;
+            upper = &upperBound;
+            depth = 0;
+
+            const Node *n = guard.root;
+            while (n != NULL)
+            {
+                if (!tree->compare(n->key, lower))
+                {
+                    path[depth++] = n;
+                    n = n->left;
+                }
+                else
+                {
+                    n = n->right;
+                }
+            }
+        }
+
+        void startAtMin(const ReadGuard &guard)
+        {
+            tree = &guard.tree;
+            upper = NULL;
+            depth = 0;
+
+            const Node *n = guard.root;
+            while (n != NULL)
+            {
+                path[depth++] = n;
+                n = n->left;
+            }
+        }
+
+        const Key *peek() const
+        {
+            if (depth == 0 || (upper != NULL && tree->compare(*upper, path[depth - 1]->key)))
+            {
+                return NULL;
+            }
+            return &path[depth - 1]->key;
+        }
+
+        const Key *next()
+        {
+            const Key *key = peek();
+            if (key == NULL)
+            {
+                return NULL;
+            }
+            const Node *n = path[--depth]->right;
+            while (n != NULL)
+            {
+                path[depth++] = n;
+                n = n->left;
+            }
+            return key;
+        }
+
+    private:
+        const PersistentAvlTree *tree;
+        const Key *upper; // caller keeps the bound alive while scanning
+        const Node *path[MAX_DEPTH];
+        int depth;
+    };
+
+    // WRITERS
+
+    // Insert key into a new version; returns false if it was already there
+    bool insert(const Key &key)
+    {
+        std::lock_guard<std::mutex> lock(writeLock);
+        Node *oldRoot = root.load(std::memory_order_relaxed);
+        if (findIn(oldRoot, key))
+        {
+            return false;
+        }
+
+        beginWrite();
+        Node *newRoot = insertAt(oldRoot, key);
+        publish(newRoot);
+        return true;
+    }
+
+    // Delete key in a new version; returns false if it wasn't there
+    bool erase(const Key &key)
+    {
+        std::lock_guard<std::mutex> lock(writeLock);
+        Node *oldRoot = root.load(std::memory_order_relaxed);
+        if (!findIn(oldRoot, key))
+        {
+            return false;
+        }
+
+        beginWrite();
+        Node *newRoot = eraseAt(oldRoot, key);
+        publish(newRoot);
+        return true;
+    }
+
+    // Publish an empty version; the old tree is freed once unpinned
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(writeLock);
+        beginWrite();
+        pending.wholeTree = root.load(std::memory_order_relaxed);
+        publish(NULL);
+    }
+
+    // Merge a batch of keys with the current version & publish a freshly
+    // built, perfectly balanced version (the old one is retired whole)
+    void bulkInsert(std::vector<Key> keys)
+    {
+        std::lock_guard<std::mutex> lock(writeLock);
+        std::sort(keys.begin(), keys.end(), compare);
+
+        Node *oldRoot = root.load(std::memory_order_relaxed);
+        std::vector<Key> existing;
+        existing.reserve(getSize(oldRoot));
+        collectKeys(oldRoot, existing);
+
+        std::vector<Key> merged;
+        merged.reserve(existing.size() + keys.size());
+        std::merge(existing.begin(), existing.end(), keys.begin(), keys.end(), std::back_inserter(merged), compare);
+        merged.erase(std::unique(merged.begin(), merged.end(), [this](const Key &a, const Key &b)
+                                 { return !compare(a, b) && !compare(b, a); }),
+                     merged.end());
+
+        beginWrite();
+        pending.wholeTree = oldRoot;
+        publish(buildBalanced(merged, 0, merged.size()));
+    }
+
+    // number of retired batches still waiting for readers to move on
+    size_t retiredBatches() const { return retired.size(); }
+
+    // node memory, including retired nodes not yet freed (writer side)
+    size_t bytesUsed() const { return pool.slabsAllocated() * pool.bytesPerSlab(); }
+
+#ifdef AVL_DEBUG
+    // Debug-only checker for the current version (writer side)
+    void validate() const
+    {
+        validateSubtree(root.load(), NULL, NULL);
+    }
+#endif
+
+private:
+    // nodes replaced by one write; freed once no reader can reach them
+    struct RetiredBatch
+    {
+        uint64_t epoch;
+        std::vector<Node *> nodes;
+        Node *wholeTree; // an entire old version dropped by clear/bulkInsert
+    };
+
+    // one per registered reader; own cache line so readers don't
+    // slow each other down by sharing it
+    struct alignas(64) ReaderSlot
+    {
+        std::atomic<uint64_t> epoch; // 0 = not reading
+        std::atomic<bool> inUse;
+
+        ReaderSlot() : epoch(0), inUse(false) {}
+    };
+
+    std::atomic<Node *> root;
+    std::atomic<uint64_t> globalEpoch;
+    mutable ReaderSlot readers[MAX_READERS];
+    Compare compare;
+
+    // writer-only state (guarded by writeLock)
+    std::mutex writeLock;
+    uint64_t writeId;
+    SlabPool<Node> pool;
+    RetiredBatch pending;
+    std::vector<RetiredBatch> retired;
+
+    static int getHeight(const Node *n)
+    {
+        return n == NULL ? 0 : n->height;
+    }
+
+    static size_t getSize(const Node *n)
+    {
+        return n == NULL ? 0 : n->size;
+    }
+
+    static void updateNode(Node *n)
+    {
+        n->height = std::max(getHeight(n->left), getHeight(n->right)) + 1;
+        n->size = getSize(n->left) + getSize(n->right) + 1;
+    }
+
+    static int getBalanceFactor(const Node *n)
+    {
+        return getHeight(n->left) - getHeight(n->right);
+    }
+
+    bool findIn(const Node *current, const Key &key) const
+    {
+        while (current != NULL)
+        {
+            if (compare(key, current->key))
+            {
+                current = current->left;
+            }
+            else if (compare(current->key, key))
+            {
+                current = current->right;
+            }
+            else
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void beginWrite()
+    {
+        writeId++;
+        pending.nodes.clear();
+        pending.wholeTree = NULL;
+    }
+
+    Node *createNode(const Key &key, Node *left, Node *right)
+    {
+        Node *n = pool.allocate();
+        n->key = key;
+        n->left = left;
+        n->right = right;
+        n->writeId = writeId;
+        updateNode(n);
+        return n;
+    }
+
+    // Get a node this write may modify: nodes it created already are,
+    // published ones are copied & the original retired
+    Node *own(Node *n)
+    {
+        if (n->writeId == writeId)
+        {
+            return n;
+        }
+        pending.nodes.push_back(n);
+        return createNode(n->key, n->left, n->right);
+    }
+
+    // Make newRoot the current version, retire what it replaced,
+    // and free whatever no reader can see anymore
+    void publish(Node *newRoot)
+    {
+        root.store(newRoot);
+        pending.epoch = globalEpoch.fetch_add(1);
+        if (!pending.nodes.empty() || pending.wholeTree != NULL)
+        {
+            retired.push_back(pending);
+        }
+        reclaim();
+#ifdef AVL_DEBUG
+        validate();
+#endif
+    }
+
+    void reclaim()
+    {
+        // oldest epoch a reader is still pinned at
+        uint64_t oldestPinned = UINT64_MAX;
+        for (int i = 0; i < MAX_READERS; i++)
+        {
+            uint64_t epoch = readers[i].epoch.load();
+            if (epoch != 0 && epoch < oldestPinned)
+            {
+                oldestPinned = epoch;
+            }
+        }
+
+        // readers pinned after a batch was retired can't reach it
+        size_t freed = 0;
+        while (freed < retired.size() && retired[freed].epoch < oldestPinned)
+        {
+            freeBatch(retired[freed]);
+            freed++;
+        }
+        retired.erase(retired.begin(), retired.begin() + freed);
+    }
+
+    void freeBatch(RetiredBatch &batch)
+    {
+        for (size_t i = 0; i < batch.nodes.size(); i++)
+        {
+            pool.free(batch.nodes[i]);
+        }
+        freeSubtree(batch.wholeTree);
+    }
+
+    void freeSubtree(Node *n)
+    {
+        if (n == NULL)
+            return;
+        freeSubtree(n->left);
+        freeSubtree(n->right);
+        pool.free(n);
+    }
+
+    // ROTATIONS on owned nodes; each owns the child it lifts
+    // and returns the new subtree root
+
+    Node *rotateRight(Node *n)
+    {
+        Node *leftChild = own(n->left);
+        n->left = leftChild->right;
+        leftChild->right = n;
+        updateNode(n);
+        updateNode(leftChild);
+        return leftChild;
+    }
+
+    Node *rotateLeft(Node *n)
+    {
+        Node *rightChild = own(n->right);
+        n->right = rightChild->left;
+        rightChild->left = n;
+        updateNode(n);
+        updateNode(rightChild);
+        return rightChild;
+    }
+
+    // Fix an owned node whose children may differ in height by 2
+    Node *rebalance(Node *n)
+    {
+        updateNode(n);
+        int balanceFactor = getBalanceFactor(n);
+        if (balanceFactor == 2)
+        {
+            if (getBalanceFactor(n->left) < 0)
+            {
+                // LR imbalance
+                n->left = rotateLeft(own(n->left));
+            }
+            // LL imbalance
+            return rotateRight(n);
+        }
+        if (balanceFactor == -2)
+        {
+            if (getBalanceFactor(n->right) > 0)
+            {
+                // RL imbalance
+                n->right = rotateRight(own(n->right));
+            }
+            // RR imbalance
+            return rotateLeft(n);
+        }
+        return n;
+    }
+
+    // key is known not to be in subtree n
+    Node *insertAt(Node *n, const Key &key)
+    {
+        if (n == NULL)
+        {
+            return createNode(key, NULL, NULL);
+        }
+        n = own(n);
+        if (compare(key, n->key))
+        {
+            n->left = insertAt(n->left, key);
+        }
+        else
+        {
+            n->right = insertAt(n->right, key);
+        }
+        return rebalance(n);
+    }
+
+    // Unlink the min node of (owned) subtree n into minNode
+    Node *removeMin(Node *n, Node *&minNode)
+    {
+        if (n->left == NULL)
+        {
+            minNode = n;
+            return n->right;
+        }
+        n = own(n);
+        n->left = removeMin(n->left, minNode);
+        return rebalance(n);
+    }
+
+    // key is known to be in subtree n
+    Node *eraseAt(Node *n, const Key &key)
+    {
+        if (compare(key, n->key))
+        {
+            n = own(n);
+            n->left = eraseAt(n->left, key);
+            return rebalance(n);
+        }
+        if (compare(n->key, key))
+        {
+            n = own(n);
+            n->right = eraseAt(n->right, key);
+            return rebalance(n);
+        }
+
+        // found it; the old node is retired either way
+        if (n->writeId != writeId)
+        {
+            pending.nodes.push_back(n);
+        }
+        if (n->left == NULL || n->right == NULL)
+        {
+            return n->left != NULL ? n->left : n->right;
+        }
+
+        // 2 children: min of the right subtree takes n's place
+        Node *minNode;
+        Node *right = removeMin(n->right, minNode);
+        Node *replacement = createNode(minNode->key, n->left, right);
+        if (minNode->writeId != writeId)
+        {
+            pending.nodes.push_back(minNode);
+        }
+        else
+        {
+            pool.free(minNode);
+        }
+        return rebalance(replacement);
+    }
+
+    static void collectKeys(const Node *n, std::vector<Key> &keys)
+    {
+        if (n == NULL)
+            return;
+        collectKeys(n->left, keys);
+        keys.push_back(n->key);
+        collectKeys(n->right, keys);
+    }
+
+    Node *buildBalanced(const std::vector<Key> &keys, size_t lo, size_t hi)
+    {
+        if (lo >= hi)
+        {
+            return NULL;
+        }
+        size_t mid = lo + (hi - lo) / 2;
+        Node *left = buildBalanced(keys, lo, mid);
+        Node *right = buildBalanced(keys, mid + 1, hi);
+        return createNode(keys[mid], left, right);
+    }
+
+#ifdef AVL_DEBUG
+    int validateSubtree(const Node *n, const Key *low, const Key *high) const
+    {
+        if (n == NULL)
+        {
+            return 0;
+        }
+        assert(low == NULL || compare(*low, n->key));
+        assert(high == NULL || compare(n->key, *high));
+        int leftHeight = validateSubtree(n->left, low, &n->key);
+        int rightHeight = validateSubtree(n->right, &n->key, high);
+        assert(n->height == std::max(leftHeight, rightHeight) + 1);
+        assert(n->size == getSize(n->left) + getSize(n->right) + 1);
+        assert(leftHeight - rightHeight <= 1 && rightHeight - leftHeight <= 1);
+        return n->height;
+    }
+#endif
+};
+
+#endif
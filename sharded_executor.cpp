@@ -0,0 +1,528 @@
+#include "sharded_executor.h"
+
+#include <algorithm>
+#include <thread>
+#include "output.h"
+
+using namespace std;
+
+ShardedExecutor::ShardedExecutor(int shardCount)
+    : shards(shardCount < 1 ? 1 : shardCount), batchesSinceResplit(0), resplits(0)
+{
+    ops.reserve(BATCH_SIZE);
+}
+
+// QUEUED OPERATIONS
+
+void ShardedExecutor::queue(OpKind kind, int a, int b, int limit)
+{
+    Op op = {kind, a, b, limit, 0};
+    if (ops.size() % SAMPLE_RATE == 0)
+    {
+        sample.push_back(a);
+    }
+    ops.push_back(op);
+    if (ops.size() == BATCH_SIZE)
+    {
+        flush();
+    }
+}
+
+void ShardedExecutor::insert(int key) { queue(OP_INSERT, key, 0, 0); }
+void ShardedExecutor::erase(int key) { queue(OP_DELETE, key, 0, 0); }
+void ShardedExecutor::search(int key) { queue(OP_FIND, key, 0, 0); }
+void ShardedExecutor::searchRange(int a, int b, int limit) { queue(OP_RANGE, a, b, limit); }
+void ShardedExecutor::count(int a, int b) { queue(OP_COUNT, a, b, 0); }
+void ShardedExecutor::rank(int key) { queue(OP_RANK, key, 0, 0); }
+
+// WHOLE-TREE OPERATIONS
+
+void ShardedExecutor::initialize()
+{
+    flush();
+    for (size_t s = 0; s < shards.size(); s++)
+    {
+        shards[s].tree.clear();
+    }
+    // nothing to move, so the next batch picks fresh split points
+    splits.clear();
+}
+
+void ShardedExecutor::bulkInsert(vector<int> keys)
+{
+    flush();
+    if (totalSize() == 0)
+    {
+        // split the keys themselves evenly
+        sort(keys.begin(), keys.end());
+        splits.clear();
+        for (size_t s = 1; s < shards.size() && !keys.empty(); s++)
+        {
+            splits.push_back(keys[s * keys.size() / shards.size()]);
+        }
+    }
+
+    vector<vector<int>> perShard(shards.size());
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        perShard[shardOf(keys[i])].push_back(keys[i]);
+    }
+    for (size_t s = 0; s < shards.size(); s++)
+    {
+        shards[s].tree.bulkInsert(std::move(perShard[s]));
+    }
+}
+
+// Select the k-th smallest key across the shards (k = 1 is the minimum)
+void ShardedExecutor::select(int k)
+{
+    flush();
+    size_t remaining = k < 1 ? 0 : k;
+    for (size_t s = 0; s < shards.size() && remaining > 0; s++)
+    {
+        const ShardTree &tree = shards[s].tree;
+        if (remaining <= tree.size())
+        {
+            results << *tree.select(remaining) << "\n";
+            return;
+        }
+        remaining -= tree.size();
+    }
+    // no such key
+    results << "NULL\n";
+}
+
+void ShardedExecutor::nearest(int key, bool below, bool inclusive)
+{
+    flush();
+    // shards are in key order; walk away from key's shard until one has it
+    int step = below ? -1 : 1;
+    for (int s = shardOf(key); s >= 0 && s < (int)shards.size(); s += step)
+    {
+        const ShardTree &tree = shards[s].tree;
+        const int *found;
+        if (below)
+        {
+            found = inclusive ? tree.floor(key) : tree.predecessor(key);
+        }
+        else
+        {
+            found = inclusive ? tree.ceiling(key) : tree.successor(key);
+        }
+        if (found != NULL)
+        {
+            results << *found << "\n";
+            return;
+        }
+    }
+    results << "NULL\n";
+}
+
+void ShardedExecutor::allocatorStats()
+{
+    flush();
+    size_t liveNodes = 0;
+    size_t slabs = 0;
+    size_t wasted = 0;
+    for (size_t s = 0; s < shards.size(); s++)
+    {
+        SlabPool<ShardTree::Node> &nodePool = shards[s].tree.allocator();
+        liveNodes += nodePool.liveObjects();
+        slabs += nodePool.slabsAllocated();
+        wasted += nodePool.bytesWasted();
+    }
+    results << "live nodes: " << liveNodes
+            << ", slabs: " << slabs << " across " << shards.size() << " shards"
+            << ", bytes wasted: " << wasted << "\n";
+}
+
+void ShardedExecutor::stats(size_t &nodes, int &height, size_t &bytes, TreeStats &counters)
+{
+    flush();
+    nodes = 0;
+    height = 0;
+    bytes = 0;
+    counters = TreeStats();
+    for (size_t s = 0; s < shards.size(); s++)
+    {
+        ShardTree &tree = shards[s].tree;
+        nodes += tree.size();
+        height = max(height, tree.height());
+        bytes += tree.allocator().slabsAllocated() * tree.allocator().bytesPerSlab();
+        counters += tree.statistics();
+    }
+}
+
+void ShardedExecutor::sortedKeys(vector<int> &keys)
+{
+    flush();
+    keys.reserve(keys.size() + totalSize());
+    for (size_t s = 0; s < shards.size(); s++)
+    {
+        ShardTree::RangeCursor cursor;
+        cursor.startAtMin(shards[s].tree);
+        const int *key;
+        while ((key = cursor.next()) != NULL)
+        {
+            keys.push_back(*key);
+        }
+    }
+}
+
+void ShardedExecutor::summarize(int a, int b, size_t &count, long long &sum, int &min, int &max)
+{
+    flush();
+    count = 0;
+    sum = 0;
+    if (a > b)
+    {
+        return;
+    }
+    // shards are in key order: min comes from the first one with keys
+    // in range, max from the last
+    for (int s = shardOf(a); s <= shardOf(b); s++)
+    {
+        const ShardTree &tree = shards[s].tree;
+        size_t shardCount = tree.countRange(a, b);
+        if (shardCount == 0)
+        {
+            continue;
+        }
+        if (count == 0)
+        {
+            min = *tree.ceiling(a);
+        }
+        max = *tree.floor(b);
+        count += shardCount;
+        sum += tree.aggregateRange(a, b);
+    }
+}
+
+void ShardedExecutor::extractRange(int a, int b, vector<int> &removed)
+{
+    flush();
+    if (a > b)
+    {
+        return;
+    }
+    for (int s = shardOf(a); s <= shardOf(b); s++)
+    {
+        shards[s].tree.extractRange(a, b, [&removed](int &&key, NoValue &&)
+                                    { removed.push_back(key); });
+    }
+}
+
+// BATCH
+
+void ShardedExecutor::flush()
+{
+    if (ops.empty())
+    {
+        return;
+    }
+
+    if (totalSize() == 0)
+    {
+        // no keys to move yet; cut where this batch's keys are
+        splits.clear();
+        resplit();
+    }
+    route();
+    batchesSinceResplit++;
+    if (batchesSinceResplit >= RESPLIT_INTERVAL && hasHotShard())
+    {
+        batchesSinceResplit = 0;
+        resplit();
+        route();
+    }
+
+    // each shard replays its own queue; this thread takes the last one
+    vector<thread> workers;
+    size_t last = shards.size() - 1;
+    for (size_t s = 0; s < last; s++)
+    {
+        if (!shards[s].queue.empty())
+        {
+            workers.push_back(thread(&ShardedExecutor::runShard, this, s));
+        }
+    }
+    runShard(last);
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+        workers[i].join();
+    }
+
+    printResults();
+    ops.clear();
+    sample.clear();
+}
+
+size_t ShardedExecutor::totalSize() const
+{
+    size_t total = 0;
+    for (size_t s = 0; s < shards.size(); s++)
+    {
+        total += shards[s].tree.size();
+    }
+    return total;
+}
+
+int ShardedExecutor::shardOf(int key) const
+{
+    return upper_bound(splits.begin(), splits.end(), key) - splits.begin();
+}
+
+// Hand every queued op to the shards it touches & give it result slots
+void ShardedExecutor::route()
+{
+    size_t shardCount = shards.size();
+    for (size_t s = 0; s < shardCount; s++)
+    {
+        shards[s].queue.clear();
+    }
+    found.clear();
+    partCounts.clear();
+    partKeys.clear();
+
+    for (size_t i = 0; i < ops.size(); i++)
+    {
+        Op &op = ops[i];
+        switch (op.kind)
+        {
+        case OP_INSERT:
+        case OP_DELETE:
+            shards[shardOf(op.a)].queue.push_back(i);
+            break;
+
+        case OP_FIND:
+            op.slot = found.size();
+            found.push_back(0);
+            shards[shardOf(op.a)].queue.push_back(i);
+            break;
+
+        case OP_RANGE:
+            // every shard reports its size (an empty tree prints NULL),
+            // only the overlapping ones are searched
+            op.slot = partCounts.size();
+            partCounts.resize(partCounts.size() + shardCount, 0);
+            partKeys.resize(partCounts.size());
+            for (size_t s = 0; s < shardCount; s++)
+            {
+                shards[s].queue.push_back(i);
+            }
+            break;
+
+        case OP_COUNT:
+        case OP_RANK:
+        {
+            op.slot = partCounts.size();
+            partCounts.resize(partCounts.size() + shardCount, 0);
+            // Rank counts everything below key, so it starts at shard 0
+            int first = op.kind == OP_RANK ? 0 : shardOf(op.a);
+            int last = op.kind == OP_RANK ? shardOf(op.a) : shardOf(op.b);
+            for (int s = first; s <= last; s++)
+            {
+                shards[s].queue.push_back(i);
+            }
+            break;
+        }
+        }
+    }
+}
+
+bool ShardedExecutor::hasHotShard() const
+{
+    // small batches don't say much about load
+    if (ops.size() < BATCH_SIZE / 4)
+    {
+        return false;
+    }
+    size_t share = ops.size() / shards.size();
+    for (size_t s = 0; s < shards.size(); s++)
+    {
+        if (shards[s].queue.size() > HOT_FACTOR * share)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Pick split points that give each shard an equal share of the sampled
+// keys, and move the stored keys over to them (O(n))
+void ShardedExecutor::resplit()
+{
+    if (sample.empty())
+    {
+        return;
+    }
+    sort(sample.begin(), sample.end());
+    vector<int> newSplits;
+    for (size_t s = 1; s < shards.size(); s++)
+    {
+        newSplits.push_back(sample[s * sample.size() / shards.size()]);
+    }
+    if (newSplits == splits)
+    {
+        // load is skewed onto too few keys to split any finer
+        return;
+    }
+
+    if (totalSize() > 0)
+    {
+        // shards are in key order, so their keys come out sorted
+        vector<int> keys;
+        keys.reserve(totalSize());
+        for (size_t s = 0; s < shards.size(); s++)
+        {
+            ShardTree::RangeCursor cursor;
+            cursor.startAtMin(shards[s].tree);
+            const int *key;
+            while ((key = cursor.next()) != NULL)
+            {
+                keys.push_back(*key);
+            }
+            shards[s].tree.clear();
+        }
+
+        splits = newSplits;
+        size_t begin = 0;
+        for (size_t s = 0; s < shards.size(); s++)
+        {
+            size_t end = s < splits.size() ? lower_bound(keys.begin(), keys.end(), splits[s]) - keys.begin() : keys.size();
+            shards[s].tree.bulkInsert(vector<int>(keys.begin() + begin, keys.begin() + end));
+            begin = end;
+        }
+        resplits++;
+    }
+    splits = newSplits;
+}
+
+// Replay shard s's queue; writes only its own result slots
+void ShardedExecutor::runShard(size_t s)
+{
+    ShardTree &tree = shards[s].tree;
+    const vector<size_t> &shardQueue = shards[s].queue;
+    for (size_t q = 0; q < shardQueue.size(); q++)
+    {
+        const Op &op = ops[shardQueue[q]];
+        switch (op.kind)
+        {
+        case OP_INSERT:
+            tree.insert(op.a);
+            break;
+
+        case OP_DELETE:
+            tree.erase(op.a);
+            break;
+
+        case OP_FIND:
+            found[op.slot] = tree.contains(op.a);
+            break;
+
+        case OP_RANGE:
+        {
+            partCounts[op.slot + s] = tree.size();
+            if (op.a > op.b || (int)s < shardOf(op.a) || (int)s > shardOf(op.b))
+            {
+                break;
+            }
+            // a limited search needs 1 extra key for the resume token
+            vector<int> &keys = partKeys[op.slot + s];
+            ShardTree::RangeCursor cursor;
+            cursor.start(tree, op.a, op.b);
+            const int *key;
+            while ((op.limit <= 0 || keys.size() <= (size_t)op.limit) && (key = cursor.next()) != NULL)
+            {
+                keys.push_back(*key);
+            }
+            break;
+        }
+
+        case OP_COUNT:
+            partCounts[op.slot + s] = tree.countRange(op.a, op.b);
+            break;
+
+        case OP_RANK:
+            partCounts[op.slot + s] = tree.rank(op.a);
+            break;
+        }
+    }
+}
+
+// Print the batch's results in file order, merging per-shard parts
+void ShardedExecutor::printResults()
+{
+    size_t shardCount = shards.size();
+    for (size_t i = 0; i < ops.size(); i++)
+    {
+        const Op &op = ops[i];
+        switch (op.kind)
+        {
+        case OP_INSERT:
+        case OP_DELETE:
+            break;
+
+        case OP_FIND:
+            if (found[op.slot])
+            {
+                results << op.a << "\n";
+            }
+            else
+            {
+                // search was unsuccesful (or tree is empty)
+                results << "NULL\n";
+            }
+            break;
+
+        case OP_RANGE:
+        {
+            size_t size = 0;
+            for (size_t s = 0; s < shardCount; s++)
+            {
+                size += partCounts[op.slot + s];
+            }
+            if (size == 0)
+            {
+                // Nothing in AVL Tree; is empty
+                results << "NULL\n";
+                break;
+            }
+
+            // shards are in key order, so concatenating them merges them
+            int listed = 0;
+            bool more = false;
+            for (size_t s = 0; s < shardCount && !more; s++)
+            {
+                const vector<int> &keys = partKeys[op.slot + s];
+                for (size_t k = 0; k < keys.size(); k++)
+                {
+                    if (op.limit > 0 && listed == op.limit)
+                    {
+                        // hit the limit with keys left over; hand back a resume token
+                        results << "NEXT " << keys[k];
+                        more = true;
+                        break;
+                    }
+                    results << keys[k] << ", ";
+                    listed++;
+                }
+            }
+            results << "\n";
+            break;
+        }
+
+        case OP_COUNT:
+        case OP_RANK:
+        {
+            size_t total = 0;
+            for (size_t s = 0; s < shardCount; s++)
+            {
+                total += partCounts[op.slot + s];
+            }
+            results << total << "\n";
+            break;
+        }
+        }
+    }
+}
@@ -0,0 +1,136 @@
+#ifndef SHARDED_EXECUTOR_H
+#define SHARDED_EXECUTOR_H
+
+#include <cstddef>
+#include <vector>
+#include "avl_tree.h"
+
+// Runs commands on several key-range shards in parallel (--shards N).
+//
+// The key space is cut at split points sampled from the commands, and
+// each shard is its own AvlTree. Commands are queued in file order; a
+// batch is routed to per-shard queues (so every key's operations keep
+// their order) and each shard replays its queue on its own thread.
+// Range searches, Count & Rank go to every shard they overlap, and the
+// partial results are merged in shard (= key) order. Results are
+// printed in file order once the batch is done.
+//
+// Commands that need the whole tree at once (Initialize, BulkInsert,
+// Select, AllocatorStats, Stats) run the queued batch first.
+class ShardedExecutor
+{
+public:
+    explicit ShardedExecutor(int shardCount);
+
+    // queued operations; results are printed by flush()
+    void insert(int key);
+    void erase(int key);
+    void search(int key);
+    void searchRange(int a, int b, int limit);
+    void count(int a, int b);
+    void rank(int key);
+
+    // run the queued batch first, then act on all shards
+    void initialize();
+    void bulkInsert(std::vector<int> keys);
+    void select(int k);
+    // closest key below (or above) key, or key itself if inclusive
+    void nearest(int key, bool below, bool inclusive);
+    void allocatorStats();
+    // Totals over the shards: keys, node bytes & operation counters
+    // (each shard counts its own); height is the tallest shard's
+    void stats(size_t &nodes, int &height, size_t &bytes, TreeStats &counters);
+    size_t shardCount() const { return shards.size(); }
+    // every key, in order
+    void sortedKeys(std::vector<int> &keys);
+    // count, sum, min & max of the keys in [a, b] (min & max only if count > 0)
+    void summarize(int a, int b, size_t &count, long long &sum, int &min, int &max);
+    // remove keys in [a, b], appending them to removed in order
+    void extractRange(int a, int b, std::vector<int> &removed);
+
+    // Run the queued batch & print its results
+    void flush();
+
+    // number of times hot shards forced new split points
+    size_t resplitCount() const { return resplits; }
+
+private:
+    // counters for Stats() (unless built with AVL_NO_STATS); no traces,
+    // since the shards run on their own threads
+    struct ShardPolicy
+    {
+        static const bool tracing = false;
+#ifdef AVL_NO_STATS
+        static const bool statistics = false;
+#else
+        static const bool statistics = true;
+#endif
+
+        static void onTrace(const char *) {}
+        template <typename Key>
+        static void onTrace(const char *, const Key &) {}
+    };
+
+    typedef AvlTree<int, NoValue, std::less<int>, SlabPool, ShardPolicy, SumAggregate<int>> ShardTree;
+
+    // operations queued per batch before running it
+    static const size_t BATCH_SIZE = 1 << 16;
+    // a shard is hot if it gets this many times its share of a batch
+    static const size_t HOT_FACTOR = 2;
+    // batches to wait between re-splits (moving keys is O(n))
+    static const size_t RESPLIT_INTERVAL = 8;
+    // every SAMPLE_RATE-th key in a batch feeds the split points
+    static const size_t SAMPLE_RATE = 8;
+
+    enum OpKind
+    {
+        OP_INSERT,
+        OP_DELETE,
+        OP_FIND,
+        OP_RANGE,
+        OP_COUNT,
+        OP_RANK
+    };
+
+    // one queued operation; slot indexes its results
+    struct Op
+    {
+        OpKind kind;
+        int a;
+        int b;
+        int limit;
+        size_t slot;
+    };
+
+    struct Shard
+    {
+        ShardTree tree;
+        std::vector<size_t> queue; // indexes into ops, in file order
+    };
+
+    std::vector<Shard> shards;
+    // shard i holds keys in [splits[i - 1], splits[i])
+    std::vector<int> splits;
+
+    std::vector<Op> ops;
+    std::vector<int> sample;
+
+    // results of the batch; each shard writes only its own slots
+    std::vector<unsigned char> found;           // OP_FIND
+    std::vector<size_t> partCounts;             // shardCount per fan-out op
+    std::vector<std::vector<int>> partKeys;     // shardCount per OP_RANGE
+
+    size_t batchesSinceResplit;
+    size_t resplits;
+
+    void queue(OpKind kind, int a, int b, int limit);
+    size_t totalSize() const;
+    int shardOf(int key) const;
+    void route();
+    bool hasHotShard() const;
+    void resplit();
+    void runShard(size_t s);
+    void printResults();
+};
+
+#endif
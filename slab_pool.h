@@ -0,0 +1,276 @@
+#ifndef SLAB_POOL_H
+#define SLAB_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <sys/mman.h>
+
+// Pooled allocator for fixed-size objects (tree nodes).
+// Memory is grabbed from the OS in big aligned slabs, each slab keeps
+// its own free list of returned slots, and freed slots are reused before
+// any fresh memory is touched. Since slabs are aligned to their size,
+// the slab owning a slot is found by masking the slot's address.
+template <typename T>
+class SlabPool
+{
+public:
+    static constexpr size_t SMALL_SLAB_BYTES = 64 * 1024;
+    static constexpr size_t HUGE_SLAB_BYTES = 2 * 1024 * 1024;
+
+    SlabPool()
+    {
+        slabBytes = SMALL_SLAB_BYTES;
+        hugePages = false;
+        slabs = NULL;
+        oldestSlab = NULL;
+        spareSlabs = NULL;
+        partialSlabs = NULL;
+        slabCount = 0;
+        liveCount = 0;
+    }
+
+    ~SlabPool()
+    {
+        unmapList(slabs);
+        unmapList(spareSlabs);
+    }
+
+    // Back slabs with 2MB huge pages (only takes effect for slabs
+    // allocated afterwards, so set this before the first allocate)
+    void setHugePages(bool enable)
+    {
+        if (slabs != NULL || spareSlabs != NULL)
+        {
+            return;
+        }
+        hugePages = enable;
+        slabBytes = enable ? HUGE_SLAB_BYTES : SMALL_SLAB_BYTES;
+    }
+
+    // Get uninitialized memory for one object
+    T *allocate()
+    {
+        // reuse a freed slot first
+        while (partialSlabs != NULL)
+        {
+            Slab *slab = partialSlabs;
+            if (slab->freeList != NULL)
+            {
+                Slot *slot = slab->freeList;
+                slab->freeList = slot->next;
+                slab->live++;
+                liveCount++;
+                return reinterpret_cast<T *>(slot);
+            }
+            // nothing left to reuse in this slab
+            partialSlabs = slab->nextPartial;
+            slab->onPartialList = false;
+        }
+
+        // then carve a new slot off the end of the newest slab
+        if (slabs == NULL || slabs->bumped == slotsPerSlab())
+        {
+            if (!addSlab())
+            {
+                throw std::bad_alloc();
+            }
+        }
+        Slab *slab = slabs;
+        char *slot = firstSlot(slab) + slab->bumped * slotBytes();
+        slab->bumped++;
+        slab->live++;
+        liveCount++;
+        return reinterpret_cast<T *>(slot);
+    }
+
+    // Give one object's memory back to the slab it came from
+    void free(T *object)
+    {
+        Slab *slab = slabOf(object);
+        Slot *slot = reinterpret_cast<Slot *>(object);
+        slot->next = slab->freeList;
+        slab->freeList = slot;
+        slab->live--;
+        liveCount--;
+
+        if (!slab->onPartialList)
+        {
+            slab->nextPartial = partialSlabs;
+            slab->onPartialList = true;
+            partialSlabs = slab;
+        }
+    }
+
+    // Drop every object at once, in O(1).
+    // Slabs are kept for reuse & only reset when handed out again.
+    void releaseAll()
+    {
+        if (slabs != NULL)
+        {
+            // splice all in-use slabs onto the front of the spare list
+            oldestSlab->next = spareSlabs;
+            spareSlabs = slabs;
+        }
+        slabs = NULL;
+        oldestSlab = NULL;
+        partialSlabs = NULL;
+        liveCount = 0;
+    }
+
+    // STATS
+    size_t liveObjects() const { return liveCount; }
+    size_t slabsAllocated() const { return slabCount; }
+    size_t bytesPerSlab() const { return slabBytes; }
+    bool usingHugePages() const { return hugePages; }
+
+    // Bytes held from the OS that aren't storing a live object
+    // (slab headers, free & never-used slots, tail padding)
+    size_t bytesWasted() const
+    {
+        return slabCount * slabBytes - liveCount * sizeof(T);
+    }
+
+private:
+    // a free slot just links to the next free slot of its slab
+    struct Slot
+    {
+        Slot *next;
+    };
+
+    // slab header; lives at the start of every slab
+    struct Slab
+    {
+        Slab *next;        // all slabs, newest first
+        Slab *nextPartial; // slabs with freed slots to reuse
+        Slot *freeList;
+        size_t bumped; // slots handed out from fresh memory
+        size_t live;
+        bool onPartialList;
+    };
+
+    size_t slabBytes;
+    bool hugePages;
+    Slab *slabs;
+    Slab *oldestSlab; // tail of slabs, so releaseAll can splice in O(1)
+    Slab *spareSlabs;
+    Slab *partialSlabs;
+    size_t slabCount;
+    size_t liveCount;
+
+    static size_t slotBytes()
+    {
+        size_t bytes = sizeof(T) > sizeof(Slot) ? sizeof(T) : sizeof(Slot);
+        size_t align = alignof(T) > alignof(Slot) ? alignof(T) : alignof(Slot);
+        return (bytes + align - 1) / align * align;
+    }
+
+    static size_t headerBytes()
+    {
+        return (sizeof(Slab) + slotBytes() - 1) / slotBytes() * slotBytes();
+    }
+
+    size_t slotsPerSlab() const
+    {
+        return (slabBytes - headerBytes()) / slotBytes();
+    }
+
+    static char *firstSlot(Slab *slab)
+    {
+        return reinterpret_cast<char *>(slab) + headerBytes();
+    }
+
+    Slab *slabOf(T *object) const
+    {
+        uintptr_t address = reinterpret_cast<uintptr_t>(object);
+        return reinterpret_cast<Slab *>(address & ~(uintptr_t)(slabBytes - 1));
+    }
+
+    // Make a slab the newest one, reusing a spare before mapping more memory
+    bool addSlab()
+    {
+        Slab *slab = spareSlabs;
+        if (slab != NULL)
+        {
+            spareSlabs = slab->next;
+        }
+        else
+        {
+            slab = static_cast<Slab *>(mapSlab());
+            if (slab == NULL)
+            {
+                return false;
+            }
+            slabCount++;
+        }
+
+        slab->next = slabs;
+        slab->nextPartial = NULL;
+        slab->freeList = NULL;
+        slab->bumped = 0;
+        slab->live = 0;
+        slab->onPartialList = false;
+        if (slabs == NULL)
+        {
+            oldestSlab = slab;
+        }
+        slabs = slab;
+        return true;
+    }
+
+    // Map slabBytes of memory aligned to slabBytes
+    void *mapSlab()
+    {
+        void *memory;
+        if (hugePages)
+        {
+            // explicit huge pages are naturally 2MB aligned
+            memory = mmap(NULL, slabBytes, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (memory != MAP_FAILED)
+            {
+                return memory;
+            }
+        }
+
+        // over-map by one slab, then trim both ends to get alignment
+        size_t mapped = 2 * slabBytes;
+        char *raw = static_cast<char *>(mmap(NULL, mapped, PROT_READ | PROT_WRITE,
+                                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (raw == MAP_FAILED)
+        {
+            return NULL;
+        }
+        uintptr_t address = reinterpret_cast<uintptr_t>(raw);
+        char *aligned = raw + ((slabBytes - (address & (slabBytes - 1))) & (slabBytes - 1));
+        if (aligned > raw)
+        {
+            munmap(raw, aligned - raw);
+        }
+        if (aligned + slabBytes < raw + mapped)
+        {
+            munmap(aligned + slabBytes, raw + mapped - (aligned + slabBytes));
+        }
+
+#ifdef MADV_HUGEPAGE
+        if (hugePages)
+        {
+            // no reserved huge pages; ask for transparent ones instead
+            madvise(aligned, slabBytes, MADV_HUGEPAGE);
+        }
+#endif
+        return aligned;
+    }
+
+    void unmapList(Slab *slab)
+    {
+        while (slab != NULL)
+        {
+            Slab *next = slab->next;
+            munmap(slab, slabBytes);
+            slab = next;
+        }
+    }
+};
+
+#endif
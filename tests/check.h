@@ -0,0 +1,24 @@
+#ifndef TESTS_CHECK_H
+#define TESTS_CHECK_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+// What a test is doing (e.g. mode & seed), printed with a failed CHECK
+inline std::string checkContext;
+
+// Stop at the first failure, saying where & in what context; later
+// steps of a randomized run would only fail for the same reason
+#define CHECK(condition)                                                      \
+    do                                                                        \
+    {                                                                         \
+        if (!(condition))                                                     \
+        {                                                                     \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed [%s]\n", __FILE__,       \
+                    __LINE__, #condition, checkContext.c_str());              \
+            exit(1);                                                          \
+        }                                                                     \
+    } while (0)
+
+#endif
@@ -0,0 +1,143 @@
+// Key files (Save/Load): round trips with & without values, and that
+// damaged or mismatched files are rejected.
+
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../key_file.h"
+#include "check.h"
+
+using namespace std;
+
+const string PATH = "key_file_test.bin";
+
+// Write keys (& values, if any) to PATH
+bool save(const vector<int> &keys, const vector<int> &values)
+{
+    KeyFileWriter<int> writer;
+    if (!writer.open(PATH))
+    {
+        return false;
+    }
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        writer.append(keys[i]);
+    }
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        writer.appendValue(values[i]);
+    }
+    return writer.commit();
+}
+
+// Rewrite one byte of PATH
+void setByte(off_t offset, unsigned char byte)
+{
+    int fd = open(PATH.c_str(), O_RDWR);
+    CHECK(fd >= 0);
+    CHECK(pwrite(fd, &byte, 1, offset) == 1);
+    close(fd);
+}
+
+unsigned char getByte(off_t offset)
+{
+    int fd = open(PATH.c_str(), O_RDONLY);
+    CHECK(fd >= 0);
+    unsigned char byte = 0;
+    CHECK(pread(fd, &byte, 1, offset) == 1);
+    close(fd);
+    return byte;
+}
+
+// Opening PATH fails with exactly why
+void checkRejected(const char *why)
+{
+    KeyFileReader<int> reader;
+    CHECK(!reader.open(PATH));
+    CHECK(string(reader.error()) == why);
+}
+
+int main()
+{
+    // enough keys that the writer flushes several chunks, & the values
+    // straddle a chunk boundary
+    vector<int> keys;
+    vector<int> values;
+    for (int i = 0; i < 700000; i++)
+    {
+        keys.push_back(i * 3 - 1000000);
+        values.push_back(i % 1000 - 500);
+    }
+
+    checkContext = "keys only";
+    CHECK(save(keys, vector<int>()));
+    {
+        KeyFileReader<int> reader;
+        CHECK(reader.open(PATH));
+        CHECK(reader.count() == keys.size());
+        CHECK(vector<int>(reader.keys(), reader.keys() + reader.count()) == keys);
+        CHECK(reader.values<int>() == NULL);
+    }
+
+    checkContext = "keys & values";
+    CHECK(save(keys, values));
+    {
+        KeyFileReader<int> reader;
+        CHECK(reader.open(PATH));
+        CHECK(vector<int>(reader.keys(), reader.keys() + reader.count()) == keys);
+        CHECK(reader.values<int>() != NULL);
+        CHECK(vector<int>(reader.values<int>(), reader.values<int>() + reader.count()) == values);
+        // a different value type doesn't match the file
+        CHECK(reader.values<long long>() == NULL);
+    }
+
+    checkContext = "empty";
+    CHECK(save(vector<int>(), vector<int>()));
+    {
+        KeyFileReader<int> reader;
+        CHECK(reader.open(PATH));
+        CHECK(reader.count() == 0);
+    }
+
+    checkContext = "values for only some keys";
+    CHECK(!save(keys, vector<int>(values.begin(), values.begin() + 10)));
+    CHECK(access((PATH + ".tmp").c_str(), F_OK) != 0);
+
+    checkContext = "damaged files";
+    const off_t header = sizeof(KeyFileHeader);
+    CHECK(save(keys, values));
+    // one bit in a key, then in a value
+    setByte(header + 4 * 1234, getByte(header + 4 * 1234) ^ 1);
+    checkRejected("checksum mismatch");
+    CHECK(save(keys, values));
+    off_t lastByte = header + 8 * (off_t)keys.size() - 1;
+    setByte(lastByte, getByte(lastByte) ^ 0x80);
+    checkRejected("checksum mismatch");
+
+    CHECK(save(keys, values));
+    CHECK(truncate(PATH.c_str(), header + 8 * (off_t)keys.size() - 4) == 0);
+    checkRejected("size doesn't match header");
+    CHECK(truncate(PATH.c_str(), header - 1) == 0);
+    checkRejected("too short for a header");
+
+    CHECK(save(keys, values));
+    setByte(0, 'X');
+    checkRejected("not a key file");
+    CHECK(save(keys, values));
+    setByte(offsetof(KeyFileHeader, version), KEY_FILE_VERSION + 1);
+    checkRejected("unsupported version");
+
+    {
+        // 8-byte keys don't read a file of 4-byte keys
+        CHECK(save(keys, vector<int>()));
+        KeyFileReader<long long> reader;
+        CHECK(!reader.open(PATH));
+    }
+
+    unlink(PATH.c_str());
+    checkRejected("can't open file");
+
+    printf("key_file_test: passed\n");
+    return 0;
+}
@@ -0,0 +1,234 @@
+// Randomized differential test: AvlTree against std::map in every
+// balance mode, with & without lazy deletes and the lookup cache.
+// Built with AVL_DEBUG, so every mutation also re-checks the whole tree
+// (heights/ranks, sizes, summaries, tombstone count).
+
+#include <cstdint>
+#include <map>
+#include <vector>
+#include "../avl_tree.h"
+#include "check.h"
+
+using namespace std;
+
+// counters on, so their code paths run too
+struct TestPolicy
+{
+    static const bool tracing = false;
+    static const bool statistics = true;
+
+    static void onTrace(const char *) {}
+    template <typename Key>
+    static void onTrace(const char *, const Key &) {}
+};
+
+typedef AvlTree<int, int, less<int>, SlabPool, TestPolicy, SumAggregate<int>> Tree;
+typedef map<int, int> Reference;
+
+const int KEY_SPACE = 1000;
+const int STEPS = 20000;
+
+// xorshift64*, deterministic per seed
+struct Random
+{
+    uint64_t state;
+
+    explicit Random(uint64_t seed) : state(seed * 2685821657736338717ULL | 1) {}
+
+    int below(int bound)
+    {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return (int)((state * 2685821657736338717ULL >> 33) % bound);
+    }
+};
+
+// The tree holds exactly the reference's keys & values, in order
+void checkSame(const Tree &tree, const Reference &reference)
+{
+    CHECK(tree.size() == reference.size());
+    Reference::const_iterator expected = reference.begin();
+    for (Tree::Iterator it = tree.begin(); it != tree.end(); ++it, ++expected)
+    {
+        CHECK(expected != reference.end());
+        CHECK(*it == expected->first);
+        CHECK(it.value() == expected->second);
+    }
+    CHECK(expected == reference.end());
+}
+
+// Order statistics, neighbours & aggregates around key
+void checkQueries(const Tree &tree, const Reference &reference, int key, int width)
+{
+    Reference::const_iterator lower = reference.lower_bound(key);
+    Reference::const_iterator upper = reference.upper_bound(key + width);
+    size_t count = 0;
+    long long sum = 0;
+    for (Reference::const_iterator it = lower; it != upper; ++it)
+    {
+        count++;
+        sum += it->first;
+    }
+    CHECK(tree.countRange(key, key + width) == count);
+    CHECK(tree.aggregateRange(key, key + width) == sum);
+
+    size_t rank = distance(reference.begin(), reference.upper_bound(key));
+    CHECK(tree.rank(key) == rank);
+    const int *selected = tree.select(rank);
+    CHECK(rank == 0 ? selected == NULL : (selected != NULL && *selected == prev(reference.upper_bound(key))->first));
+
+    const int *ceiling = tree.ceiling(key);
+    CHECK(lower == reference.end() ? ceiling == NULL : (ceiling != NULL && *ceiling == lower->first));
+    const int *successor = tree.successor(key);
+    Reference::const_iterator after = reference.upper_bound(key);
+    CHECK(after == reference.end() ? successor == NULL : (successor != NULL && *successor == after->first));
+    const int *floor = tree.floor(key);
+    CHECK(after == reference.begin() ? floor == NULL : (floor != NULL && *floor == prev(after)->first));
+    const int *predecessor = tree.predecessor(key);
+    CHECK(lower == reference.begin() ? predecessor == NULL : (predecessor != NULL && *predecessor == prev(lower)->first));
+
+    Tree::Iterator it = tree.lowerBound(key);
+    CHECK(lower == reference.end() ? it == tree.end() : (it != tree.end() && *it == lower->first));
+}
+
+void run(BalanceMode balance, double lazyRatio, size_t cacheEntries, uint64_t seed)
+{
+    Tree tree;
+    Reference reference;
+    tree.setBalance(balance);
+    tree.setLazyDelete(lazyRatio);
+    if (cacheEntries > 0)
+    {
+        tree.enableCache(cacheEntries);
+    }
+    Random random(seed);
+
+    for (int step = 0; step < STEPS; step++)
+    {
+        int key = random.below(KEY_SPACE);
+        int value = random.below(100) - 50;
+        int op = random.below(100);
+        if (op < 30)
+        {
+            CHECK(tree.insert(key, value) == reference.insert(make_pair(key, value)).second);
+        }
+        else if (op < 50)
+        {
+            CHECK(tree.erase(key) == (reference.erase(key) == 1));
+        }
+        else if (op < 65)
+        {
+            int *found = tree.find(key);
+            Reference::iterator expected = reference.find(key);
+            CHECK(tree.contains(key) == (expected != reference.end()));
+            CHECK(expected == reference.end() ? found == NULL : (found != NULL && *found == expected->second));
+        }
+        else if (op < 70)
+        {
+            CHECK(tree.upsert(key, value) == (reference.count(key) == 0));
+            reference[key] = value;
+        }
+        else if (op < 75)
+        {
+            CHECK(tree.increment(key, value) == (reference[key] += value));
+        }
+        else if (op < 78)
+        {
+            CHECK(tree.getOrInsert(key, value) == reference.insert(make_pair(key, value)).first->second);
+        }
+        else if (op < 82)
+        {
+            // range delete, removed keys handed over in order
+            int b = key + random.below(KEY_SPACE / 10);
+            vector<int> removed;
+            tree.extractRange(key, b, [&removed](int &&k, int &&)
+                              { removed.push_back(k); });
+            Reference::iterator first = reference.lower_bound(key);
+            Reference::iterator last = reference.upper_bound(b);
+            vector<int> expected;
+            for (Reference::iterator it = first; it != last; ++it)
+            {
+                expected.push_back(it->first);
+            }
+            reference.erase(first, last);
+            CHECK(removed == expected);
+        }
+        else if (op < 85)
+        {
+            // merge a sorted batch; existing keys keep their values
+            vector<int> keys;
+            vector<int> values;
+            for (int k = key; k < key + 60 && k < KEY_SPACE; k += 1 + random.below(6))
+            {
+                keys.push_back(k);
+                values.push_back(k % 7);
+                reference.insert(make_pair(k, k % 7));
+            }
+            tree.mergeSorted(keys.data(), keys.size(), values.data());
+        }
+        else if (op < 86)
+        {
+            // bulk insert (unsorted, with duplicates); new keys get 0
+            vector<int> keys;
+            for (int i = 0; i < 20; i++)
+            {
+                int k = random.below(KEY_SPACE);
+                keys.push_back(k);
+                reference.insert(make_pair(k, 0));
+            }
+            tree.bulkInsert(keys);
+        }
+        else if (op < 87 && step % 7 == 0)
+        {
+            tree.compact();
+            CHECK(tree.tombstoneCount() == 0);
+        }
+        else
+        {
+            checkQueries(tree, reference, key, random.below(KEY_SPACE / 5));
+        }
+
+        if (step % 500 == 0)
+        {
+            checkSame(tree, reference);
+        }
+    }
+    checkSame(tree, reference);
+
+    // switching modes (or lazy deletes off) keeps the contents
+    tree.setBalance(balance == BALANCE_AVL ? BALANCE_WAVL : BALANCE_AVL);
+    tree.setLazyDelete(0);
+    CHECK(tree.tombstoneCount() == 0);
+    checkSame(tree, reference);
+    tree.clear();
+    CHECK(tree.size() == 0 && tree.begin() == tree.end());
+}
+
+int main()
+{
+    const BalanceMode balances[] = {BALANCE_AVL, BALANCE_WAVL, BALANCE_RELAXED};
+    const char *balanceNames[] = {"avl", "wavl", "relaxed"};
+    const double lazyRatios[] = {0, 0.3};
+    const size_t cacheSizes[] = {0, 64};
+
+    int runs = 0;
+    for (int b = 0; b < 3; b++)
+    {
+        for (double lazyRatio : lazyRatios)
+        {
+            for (size_t cacheEntries : cacheSizes)
+            {
+                for (uint64_t seed = 1; seed <= 3; seed++)
+                {
+                    checkContext = string("balance ") + balanceNames[b] + ", lazy delete " + to_string(lazyRatio) +
+                                   ", cache " + to_string(cacheEntries) + ", seed " + to_string(seed);
+                    run(balances[b], lazyRatio, cacheEntries, seed);
+                    runs++;
+                }
+            }
+        }
+    }
+    printf("tree_test: %d runs of %d steps passed\n", runs, STEPS);
+    return 0;
+}
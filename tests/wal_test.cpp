@@ -0,0 +1,213 @@
+// Write-ahead log: replay of intact logs, torn & damaged tails, and
+// what happens when the log can't be written.
+
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../wal.h"
+#include "check.h"
+
+using namespace std;
+
+struct Replayed
+{
+    WalOp op;
+    int key;
+    int value;
+
+    bool operator==(const Replayed &other) const
+    {
+        return op == other.op && key == other.key && value == other.value;
+    }
+};
+
+vector<Replayed> replayed;
+
+void collect(WalOp op, int key, int value)
+{
+    Replayed record = {op, key, op == WAL_SET || op == WAL_DELETE_RANGE ? value : 0};
+    replayed.push_back(record);
+}
+
+const string PATH = "wal_test.log";
+// bytes per record on disk
+const off_t RECORD = 12;
+
+off_t fileSize()
+{
+    struct stat info;
+    return stat(PATH.c_str(), &info) == 0 ? info.st_size : -1;
+}
+
+// Open the log & replay it into replayed (the log stays open in wal)
+size_t reopen(WriteAheadLog &wal)
+{
+    replayed.clear();
+    CHECK(wal.open(PATH, 4, 0));
+    return wal.replay(collect);
+}
+
+// Log the records of expected (one group commit per 4)
+void write(WriteAheadLog &wal, const vector<Replayed> &expected)
+{
+    for (size_t i = 0; i < expected.size(); i++)
+    {
+        const Replayed &r = expected[i];
+        if (r.op == WAL_SET)
+        {
+            CHECK(wal.appendSet(r.key, r.value));
+        }
+        else if (r.op == WAL_DELETE_RANGE)
+        {
+            CHECK(wal.appendDeleteRange(r.key, r.value));
+        }
+        else
+        {
+            CHECK(wal.append(r.op, r.key));
+        }
+    }
+}
+
+void flipByte(off_t offset)
+{
+    int fd = open(PATH.c_str(), O_RDWR);
+    CHECK(fd >= 0);
+    unsigned char byte;
+    CHECK(pread(fd, &byte, 1, offset) == 1);
+    byte ^= 0x40;
+    CHECK(pwrite(fd, &byte, 1, offset) == 1);
+    close(fd);
+}
+
+int main()
+{
+    unlink(PATH.c_str());
+    const vector<Replayed> records = {
+        {WAL_CLEAR, 0, 0},
+        {WAL_INSERT, 5, 0},
+        {WAL_INSERT, -7, 0},
+        {WAL_SET, 5, 42},
+        {WAL_DELETE, -7, 0},
+        {WAL_DELETE_RANGE, 1, 9},
+        {WAL_INSERT, 2147483647, 0},
+        {WAL_SET, 8, -1},
+    };
+    // 8 records, 2 of them SET pairs & 1 DELETE_RANGE pair
+    const off_t logBytes = (8 + 3) * RECORD;
+
+    checkContext = "intact log";
+    {
+        WriteAheadLog wal;
+        CHECK(reopen(wal) == 0);
+        write(wal, records);
+        CHECK(wal.close());
+    }
+    CHECK(fileSize() == logBytes);
+    {
+        WriteAheadLog wal;
+        CHECK(reopen(wal) == records.size());
+        CHECK(replayed == records);
+    }
+
+    checkContext = "torn record";
+    CHECK(truncate(PATH.c_str(), logBytes - 5) == 0);
+    {
+        WriteAheadLog wal;
+        // the last SET lost part of its VALUE half: the pair is dropped
+        CHECK(reopen(wal) == records.size() - 1);
+        CHECK(replayed == vector<Replayed>(records.begin(), records.end() - 1));
+        CHECK(fileSize() == logBytes - 2 * RECORD);
+        // new records follow the last good one
+        CHECK(wal.append(WAL_INSERT, 99));
+        CHECK(wal.close());
+    }
+    {
+        WriteAheadLog wal;
+        CHECK(reopen(wal) == records.size());
+        CHECK(replayed.back().op == WAL_INSERT && replayed.back().key == 99);
+    }
+
+    checkContext = "pair without its second half";
+    CHECK(truncate(PATH.c_str(), 6 * RECORD) == 0);
+    {
+        // CLEAR, INSERT, INSERT, SET + VALUE, DELETE
+        WriteAheadLog wal;
+        CHECK(reopen(wal) == 5);
+    }
+    // cut between SET & VALUE: the SET goes too
+    CHECK(truncate(PATH.c_str(), 4 * RECORD) == 0);
+    {
+        WriteAheadLog wal;
+        CHECK(reopen(wal) == 3);
+        CHECK(fileSize() == 3 * RECORD);
+    }
+
+    checkContext = "damaged record";
+    unlink(PATH.c_str());
+    {
+        WriteAheadLog wal;
+        reopen(wal);
+        write(wal, records);
+        CHECK(wal.close());
+    }
+    // a flipped bit in the 3rd record: it & everything after are dropped
+    flipByte(2 * RECORD + 5);
+    {
+        WriteAheadLog wal;
+        CHECK(reopen(wal) == 2);
+        CHECK(fileSize() == 2 * RECORD);
+    }
+
+    checkContext = "reset";
+    {
+        WriteAheadLog wal;
+        reopen(wal);
+        write(wal, records);
+        CHECK(wal.reset());
+        CHECK(wal.recordsSinceCheckpoint() == 0);
+        CHECK(wal.append(WAL_INSERT, 1));
+        CHECK(wal.close());
+    }
+    {
+        WriteAheadLog wal;
+        CHECK(reopen(wal) == 1);
+    }
+    unlink(PATH.c_str());
+
+    checkContext = "failed by the caller";
+    {
+        WriteAheadLog wal;
+        reopen(wal);
+        CHECK(wal.append(WAL_INSERT, 1));
+        CHECK(wal.sync());
+        wal.fail("given up by the test");
+        CHECK(wal.failed());
+        CHECK(!wal.append(WAL_INSERT, 2));
+        CHECK(!wal.close());
+    }
+    {
+        // what was synced before stays
+        WriteAheadLog wal;
+        CHECK(reopen(wal) == 1);
+    }
+    unlink(PATH.c_str());
+
+    checkContext = "failed write";
+    if (access("/dev/full", W_OK) == 0)
+    {
+        // every write fails with ENOSPC: the log gives up & says so
+        WriteAheadLog wal;
+        CHECK(wal.open("/dev/full", 2, 0));
+        CHECK(wal.append(WAL_INSERT, 1));
+        CHECK(!wal.append(WAL_INSERT, 2));
+        CHECK(wal.failed());
+        CHECK(!wal.append(WAL_INSERT, 3));
+        CHECK(!wal.sync());
+        CHECK(!wal.close());
+    }
+
+    printf("wal_test: passed\n");
+    return 0;
+}
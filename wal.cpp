@@ -0,0 +1,217 @@
+#include "wal.h"
+
+#include <cerrno>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+WriteAheadLog::WriteAheadLog()
+{
+    fd = -1;
+    syncEvery = 1;
+    syncMillis = 0;
+    sinceCheckpoint = 0;
+    syncs = 0;
+    durableEnd = 0;
+    broken = false;
+}
+
+WriteAheadLog::~WriteAheadLog()
+{
+    close();
+}
+
+bool WriteAheadLog::open(const string &fileName, size_t syncOps, unsigned int syncMs)
+{
+    close();
+    fd = ::open(fileName.c_str(), O_RDWR | O_CREAT, 0644);
+    syncEvery = syncOps < 1 ? 1 : syncOps;
+    syncMillis = syncMs;
+    pending.reserve(syncEvery);
+    pending.clear();
+    sinceCheckpoint = 0;
+    durableEnd = 0;
+    broken = false;
+    return fd >= 0;
+}
+
+bool WriteAheadLog::close()
+{
+    if (fd >= 0)
+    {
+        sync();
+        ::close(fd);
+    }
+    fd = -1;
+    return !broken;
+}
+
+size_t WriteAheadLog::replay(void (*apply)(WalOp op, int key, int value))
+{
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0)
+    {
+        return 0;
+    }
+
+    // read the log in blocks of records
+    vector<Record> block(4096);
+    size_t replayed = 0;
+    // end of the last complete record (or SET pair); read position
+    off_t offset = 0;
+    off_t position = 0;
+    // a SET or DELETE_RANGE still waiting for its VALUE (which may be
+    // in the next block)
+    bool pairPending = false;
+    WalOp pairOp = WAL_SET;
+    int pairKey = 0;
+    bool torn = false;
+    while (!torn && position < info.st_size)
+    {
+        ssize_t bytes = pread(fd, block.data(), block.size() * sizeof(Record), position);
+        if (bytes <= 0)
+        {
+            break;
+        }
+        size_t records = bytes / sizeof(Record);
+        if (records == 0)
+        {
+            // partial record at the end
+            torn = true;
+            break;
+        }
+        for (size_t i = 0; i < records; i++)
+        {
+            const Record &record = block[i];
+            if (record.check != checksum(record) || record.op < WAL_INSERT || record.op > WAL_DELETE_RANGE ||
+                pairPending != (record.op == WAL_VALUE))
+            {
+                torn = true;
+                break;
+            }
+            position += sizeof(Record);
+            if (record.op == WAL_SET || record.op == WAL_DELETE_RANGE)
+            {
+                pairPending = true;
+                pairOp = (WalOp)record.op;
+                pairKey = record.key;
+                continue;
+            }
+            if (pairPending)
+            {
+                apply(pairOp, pairKey, record.key);
+                pairPending = false;
+            }
+            else
+            {
+                apply((WalOp)record.op, record.key, 0);
+            }
+            offset = position;
+            replayed++;
+        }
+    }
+
+    if (offset < info.st_size)
+    {
+        // drop the torn tail so new records follow the last good one
+        cerr << "Write-ahead log: dropping " << (info.st_size - offset) << " damaged byte(s) at the end" << endl;
+        if (ftruncate(fd, offset) != 0)
+        {
+            cerr << "Write-ahead log: could not truncate" << endl;
+        }
+    }
+    lseek(fd, offset, SEEK_SET);
+    durableEnd = offset;
+    sinceCheckpoint = replayed;
+    return replayed;
+}
+
+bool WriteAheadLog::sync()
+{
+    if (broken)
+    {
+        return false;
+    }
+    if (fd < 0 || pending.empty())
+    {
+        return true;
+    }
+
+    const char *p = reinterpret_cast<const char *>(pending.data());
+    size_t length = pending.size() * sizeof(Record);
+    while (length > 0)
+    {
+        ssize_t written = write(fd, p, length);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            fail("write failed");
+            return false;
+        }
+        p += written;
+        length -= written;
+    }
+    if (fdatasync(fd) != 0)
+    {
+        fail("fdatasync failed");
+        return false;
+    }
+    durableEnd += pending.size() * sizeof(Record);
+    pending.clear();
+    syncs++;
+    return true;
+}
+
+bool WriteAheadLog::reset()
+{
+    if (broken)
+    {
+        return false;
+    }
+    if (fd < 0)
+    {
+        return true;
+    }
+    if (ftruncate(fd, 0) != 0 || fsync(fd) != 0)
+    {
+        fail("could not reset");
+        return false;
+    }
+    // whatever is pending is already part of the checkpoint
+    pending.clear();
+    lseek(fd, 0, SEEK_SET);
+    durableEnd = 0;
+    sinceCheckpoint = 0;
+    return true;
+}
+
+// Give up on the log: cut off whatever part of the group made it out
+// (so the file ends on the last durable record) & keep the group pending
+void WriteAheadLog::fail(const char *what)
+{
+    cerr << "Write-ahead log: " << what << "; no more changes will be logged" << endl;
+    broken = true;
+    if (ftruncate(fd, durableEnd) != 0)
+    {
+        cerr << "Write-ahead log: could not truncate" << endl;
+    }
+    lseek(fd, durableEnd, SEEK_SET);
+}
+
+// 32-bit mix of a record's fields; a zeroed record never passes
+uint32_t WriteAheadLog::checksum(const Record &record)
+{
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ ((uint64_t)record.op << 32) ^ (uint32_t)record.key;
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return (uint32_t)h;
+}
@@ -0,0 +1,162 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+// what a log record does
+enum WalOp
+{
+    WAL_INSERT = 1,
+    WAL_DELETE = 2,
+    WAL_CLEAR = 3,
+    // key's value was set: always followed by a WAL_VALUE record whose
+    // key field holds the value (the pair is replayed as one)
+    WAL_SET = 4,
+    WAL_VALUE = 5,
+    // every key in [key, b] was removed; followed by a WAL_VALUE
+    // record holding b, like WAL_SET
+    WAL_DELETE_RANGE = 6
+};
+
+// Append-only write-ahead log of tree mutations.
+//
+// Records are buffered & made durable in groups (group commit): one
+// write() + fdatasync() once syncOps records are pending or syncMillis
+// have passed since the oldest one, whichever comes first (checked as
+// records are appended, by syncIfDue between commands, and on
+// sync/close). A crash loses at most the
+// last group.
+//
+// Each record carries its own checksum, so a torn write at the tail
+// is detected on replay and cut off (a SET or DELETE_RANGE whose VALUE
+// half is missing counts as torn). Every record says what some keys end
+// up as, so replaying a log on a state that already has it applied
+// changes nothing, & a crash between writing a checkpoint and resetting
+// the log is harmless.
+//
+// If a group can't be written or synced, the log is cut back to the
+// last durable group, the records stay pending & the log counts as
+// failed from then on: append returns false and the caller must stop
+// applying mutations (a failed fdatasync can't be safely retried).
+class WriteAheadLog
+{
+public:
+    WriteAheadLog();
+    ~WriteAheadLog();
+
+    // Open (or create) the log at fileName; returns false on failure
+    bool open(const std::string &fileName, size_t syncOps, unsigned int syncMillis);
+    // Sync & close; false if the log failed (now or before)
+    bool close();
+
+    bool isOpen() const { return fd >= 0; }
+    // a write, fdatasync or reset failed; nothing more is durable
+    bool failed() const { return broken; }
+
+    // Apply every intact record in the log, oldest first, & cut off any
+    // torn tail. value is only meaningful for WAL_SET & WAL_DELETE_RANGE
+    // (the VALUE half). Returns the number of records replayed (a pair
+    // counts once).
+    size_t replay(void (*apply)(WalOp op, int key, int value));
+
+    // Log one mutation; false if the log has failed (don't apply it)
+    bool append(WalOp op, int key)
+    {
+        push(op, key);
+        sinceCheckpoint++;
+        return syncIfDue();
+    }
+
+    // Log that key now has value (both halves go out in the same group)
+    bool appendSet(int key, int value)
+    {
+        return appendPair(WAL_SET, key, value);
+    }
+
+    // Log that every key in [a, b] was removed
+    bool appendDeleteRange(int a, int b)
+    {
+        return appendPair(WAL_DELETE_RANGE, a, b);
+    }
+
+    // Write & fdatasync everything pending; false if the log has failed
+    bool sync();
+
+    // Sync if the pending group is full or its time is up; appends
+    // check this themselves, & the caller between commands, so a group
+    // doesn't outlive syncMillis just because no more mutations come
+    bool syncIfDue()
+    {
+        if (pending.size() >= syncEvery || (syncMillis > 0 && !pending.empty() && dueByTime()))
+        {
+            return sync();
+        }
+        return !broken;
+    }
+
+    // Empty the log (after a checkpoint has everything in it); false
+    // if the log has failed
+    bool reset();
+
+    // Give up on the log (e.g. a change that was never logged can't be
+    // made durable either): say why, & fail like a failed sync
+    void fail(const char *what);
+
+    // records logged since the last reset
+    size_t recordsSinceCheckpoint() const { return sinceCheckpoint; }
+    // group commits (fdatasync calls) so far
+    size_t syncCount() const { return syncs; }
+
+private:
+    struct Record
+    {
+        uint32_t op;
+        int32_t key;
+        uint32_t check;
+    };
+
+    int fd;
+    size_t syncEvery;
+    unsigned int syncMillis;
+    std::vector<Record> pending;
+    // end of the last durable group
+    off_t durableEnd;
+    bool broken;
+    std::chrono::steady_clock::time_point oldestPending;
+    size_t sinceCheckpoint;
+    size_t syncs;
+
+    static uint32_t checksum(const Record &record);
+
+    void push(WalOp op, int key)
+    {
+        Record record = {(uint32_t)op, key, 0};
+        record.check = checksum(record);
+        pending.push_back(record);
+        if (pending.size() == 1)
+        {
+            oldestPending = std::chrono::steady_clock::now();
+        }
+    }
+
+    // op & a VALUE record carrying value, in the same group
+    bool appendPair(WalOp op, int key, int value)
+    {
+        push(op, key);
+        push(WAL_VALUE, value);
+        sinceCheckpoint++;
+        return syncIfDue();
+    }
+
+    bool dueByTime() const
+    {
+        return std::chrono::steady_clock::now() - oldestPending >= std::chrono::milliseconds(syncMillis);
+    }
+};
+
+#endif